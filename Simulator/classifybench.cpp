@@ -0,0 +1,175 @@
+// Copyright 2020 Kevin Cooper
+//
+// Crestron message classification microbenchmark
+//
+// Compares the original strncmp chain from processCrestronMessage() with
+// CrestronMatcher, per message type.
+//
+// Build:   g++ -std=c++14 -O2 -I../TexecomApplication/src -o classifybench
+//              classifybench.cpp ../TexecomApplication/src/crestronmatcher.cpp
+// Run:     ./classifybench [iterations]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crestronmatcher.h"
+
+typedef CrestronMatcher::MESSAGE_TYPE MESSAGE_TYPE;
+
+// The classification chain as it was in processCrestronMessage()
+static MESSAGE_TYPE legacyClassify(const char *message, uint8_t messageLength) {
+    static const char *msgZoneUpdate = "\"Z0";
+    static const char *msgArmUpdate = "\"A0";
+    static const char *msgDisarmUpdate = "\"D0";
+    static const char *msgEntryUpdate = "\"E0";
+    static const char *msgArmingUpdate = "\"X0";
+    static const char *msgIntruderUpdate = "\"L0";
+    static const char *msgUserPinLogin = "\"U0";
+    static const char *msgUserTagLogin = "\"T0";
+    static const char *msgReplyDisarmed = "\"N";
+    static const char *msgReplyArmed = "\"Y";
+    static const char *msgWelcomeBack = "\"  Welcome Back";
+    static const char *msgScreenIdle = "\"  The Cooper's";
+    static const char *msgScreenIdlePartArmed = "\" * PART ARMED *";
+    static const char *msgScreenArmedPart = "\"Part";
+    static const char *msgScreenArmedNight = "\"Night";
+    static const char *msgScreenArmedFull = "\"Area FULL ARMED";
+    static const char *msgScreenQuestionArm = "\"Do you want to  Arm System?";
+    static const char *msgScreenQuestionPartArm = "\"Do you want to  Part Arm System?";
+    static const char *msgScreenQuestionNightArm = "\"Do you want:-   Night Arm";
+    static const char *msgScreenQuestionDisarm = "\"Do you want to  Disarm System?";
+    static const char *msgScreenAreainEntry = "\"Area in Entry";
+    static const char *msgScreenAreainExit = "\"Area in Exit >";
+
+    if (messageLength == 6 && strncmp(message, msgZoneUpdate, strlen(msgZoneUpdate)) == 0)
+        return CrestronMatcher::MESSAGE_ZONE_UPDATE;
+    else if (messageLength >= 6 && strncmp(message, msgArmUpdate, strlen(msgArmUpdate)) == 0)
+        return CrestronMatcher::MESSAGE_ARM_UPDATE;
+    else if (messageLength >= 6 && strncmp(message, msgDisarmUpdate, strlen(msgDisarmUpdate)) == 0)
+        return CrestronMatcher::MESSAGE_DISARM_UPDATE;
+    else if (messageLength == 6 && strncmp(message, msgEntryUpdate, strlen(msgEntryUpdate)) == 0)
+        return CrestronMatcher::MESSAGE_ENTRY_UPDATE;
+    else if (messageLength == 6 && strncmp(message, msgArmingUpdate, strlen(msgArmingUpdate)) == 0)
+        return CrestronMatcher::MESSAGE_ARMING_UPDATE;
+    else if (messageLength == 6 && strncmp(message, msgIntruderUpdate, strlen(msgIntruderUpdate)) == 0)
+        return CrestronMatcher::MESSAGE_INTRUDER_UPDATE;
+    else if (messageLength == 6 && (strncmp(message, msgUserPinLogin, strlen(msgUserPinLogin)) == 0 ||
+                strncmp(message, msgUserTagLogin, strlen(msgUserTagLogin)) == 0))
+        return CrestronMatcher::MESSAGE_USER_LOGIN;
+    else if (messageLength == 5 && strncmp(message, msgReplyDisarmed, strlen(msgReplyDisarmed)) == 0)
+        return CrestronMatcher::MESSAGE_REPLY_DISARMED;
+    else if (messageLength == 5 && strncmp(message, msgReplyArmed, strlen(msgReplyArmed)) == 0)
+        return CrestronMatcher::MESSAGE_REPLY_ARMED;
+    else if ((messageLength >= strlen(msgScreenArmedPart) &&
+                strncmp(message, msgScreenArmedPart, strlen(msgScreenArmedPart)) == 0) ||
+            (messageLength >= strlen(msgScreenArmedNight) &&
+                strncmp(message, msgScreenArmedNight, strlen(msgScreenArmedNight)) == 0) ||
+            (messageLength >= strlen(msgScreenIdlePartArmed) &&
+                strncmp(message, msgScreenIdlePartArmed, strlen(msgScreenIdlePartArmed)) == 0))
+        return CrestronMatcher::MESSAGE_SCREEN_PART_ARMED;
+    else if (messageLength >= strlen(msgScreenArmedFull) &&
+                strncmp(message, msgScreenArmedFull, strlen(msgScreenArmedFull)) == 0)
+        return CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED;
+    else if (messageLength >= strlen(msgScreenIdle) &&
+                strncmp(message, msgScreenIdle, strlen(msgScreenIdle)) == 0)
+        return CrestronMatcher::MESSAGE_SCREEN_IDLE;
+    else if (messageLength > strlen(msgWelcomeBack) &&
+                strncmp(message, msgWelcomeBack, strlen(msgWelcomeBack)) == 0)
+        return CrestronMatcher::MESSAGE_WELCOME_BACK;
+    else if (messageLength >= strlen(msgScreenQuestionArm) &&
+                strncmp(message, msgScreenQuestionArm, strlen(msgScreenQuestionArm)) == 0)
+        return CrestronMatcher::MESSAGE_QUESTION_ARM;
+    else if (messageLength >= strlen(msgScreenQuestionPartArm) &&
+                strncmp(message, msgScreenQuestionPartArm, strlen(msgScreenQuestionPartArm)) == 0)
+        return CrestronMatcher::MESSAGE_QUESTION_PART_ARM;
+    else if (messageLength >= strlen(msgScreenQuestionNightArm) &&
+                strncmp(message, msgScreenQuestionNightArm, strlen(msgScreenQuestionNightArm)) == 0)
+        return CrestronMatcher::MESSAGE_QUESTION_NIGHT_ARM;
+    else if (messageLength >= strlen(msgScreenQuestionDisarm) &&
+                strncmp(message, msgScreenQuestionDisarm, strlen(msgScreenQuestionDisarm)) == 0)
+        return CrestronMatcher::MESSAGE_QUESTION_DISARM;
+    else if (messageLength >= strlen(msgScreenAreainEntry) &&
+                strncmp(message, msgScreenAreainEntry, strlen(msgScreenAreainEntry)) == 0)
+        return CrestronMatcher::MESSAGE_SCREEN_AREA_ENTRY;
+    else if (messageLength >= strlen(msgScreenAreainExit) &&
+                strncmp(message, msgScreenAreainExit, strlen(msgScreenAreainExit)) == 0)
+        return CrestronMatcher::MESSAGE_SCREEN_AREA_EXIT;
+    return CrestronMatcher::MESSAGE_UNKNOWN;
+}
+
+static uint64_t nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Keeps the compiler from hoisting the classification out of the loop
+static volatile uint32_t sink;
+
+template <typename CLASSIFIER>
+static double timeClassifier(CLASSIFIER classify, const char *message, uint8_t length, uint32_t iterations) {
+    char frame[101];
+    memcpy(frame, message, length);
+    frame[length] = '\0';
+
+    uint64_t start = nowNanos();
+    for (uint32_t i = 0; i < iterations; i++) {
+        asm volatile("" : : "r"(frame) : "memory");  // Force a fresh classification
+        sink += classify(frame, length);
+    }
+    return (double) (nowNanos() - start) / iterations;
+}
+
+static CrestronMatcher matcher;
+
+static MESSAGE_TYPE matcherClassify(const char *message, uint8_t messageLength) {
+    return matcher.classify(message, messageLength);
+}
+
+int main(int argc, char **argv) {
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 2000000;
+
+    CrestronMatcher::SCREEN_CONFIG screens;
+    CrestronMatcher::getDefaultScreens(&screens);
+    matcher.begin(&screens);
+
+    const char *samples[] = {
+        "\"Z0091",
+        "\"A0011",
+        "\"D0011",
+        "\"U0011",
+        "\"N000",
+        "\"Y001",
+        "\"Part Armed",
+        "\"Area FULL ARMED ",
+        "\"  The Cooper's  ",
+        "\"  Welcome Back     Kevin",
+        "\"Do you want to  Arm System?",
+        "\"Do you want to  Part Arm System?",
+        "\"Do you want:-   Night Arm",
+        "\"Do you want to  Disarm System?",
+        "\"Area in Entry   ",
+        "\"Area in Exit >  ",
+        "\"Unrecognised screen",
+    };
+
+    printf("%-36s %10s %10s\n", "message", "legacy ns", "matcher ns");
+
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        uint8_t length = strlen(samples[i]);
+
+        if (legacyClassify(samples[i], length) != matcherClassify(samples[i], length)) {
+            printf("Mismatch classifying %s\n", samples[i]);
+            return 1;
+        }
+
+        double legacy = timeClassifier(legacyClassify, samples[i], length, iterations);
+        double matcher = timeClassifier(matcherClassify, samples[i], length, iterations);
+        printf("%-36s %10.1f %10.1f\n", samples[i], legacy, matcher);
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+// Copyright 2020 Kevin Cooper
+//
+// JobQueue tests
+//
+// Checks priority, coalescing and that a job past its deadline is reported
+// rather than silently dropped.
+//
+// Build:   g++ -std=c++14 -O2 -I../TexecomApplication/src -o jobqueuetest
+//              jobqueuetest.cpp ../TexecomApplication/src/jobqueue.cpp
+// Run:     ./jobqueuetest   (exits non-zero on failure)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "jobqueue.h"
+
+static int failures = 0;
+
+#define EXPECT(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static uint8_t expiredCount[JobQueue::JOB_TYPE_COUNT];
+
+static void jobExpired(JobQueue::JOB_TYPE type) {
+    expiredCount[type]++;
+}
+
+static void reset(JobQueue *jobs) {
+    *jobs = JobQueue();
+    jobs->setExpiredCallback(jobExpired);
+    memset(expiredCount, 0, sizeof(expiredCount));
+}
+
+static void testPriority() {
+    JobQueue jobs;
+    JobQueue::JOB_TYPE type;
+    JobQueue::JOB job;
+    reset(&jobs);
+
+    jobs.add(JobQueue::JOB_TIME_SYNC, 1000, 0);
+    jobs.add(JobQueue::JOB_ZONE_SYNC, 1000, 0);
+    jobs.add(JobQueue::JOB_ARM, 1000, 0);
+
+    EXPECT(jobs.next(&type, &job, 10) && type == JobQueue::JOB_ARM);
+    EXPECT(jobs.next(&type, &job, 10) && type == JobQueue::JOB_ZONE_SYNC);
+    EXPECT(jobs.next(&type, &job, 10) && type == JobQueue::JOB_TIME_SYNC);
+    EXPECT(!jobs.next(&type, &job, 10));
+    EXPECT(jobs.isEmpty());
+}
+
+// A repeat request keeps the first queued time and takes the later deadline
+static void testCoalesce() {
+    JobQueue jobs;
+    JobQueue::JOB_TYPE type;
+    JobQueue::JOB job;
+    reset(&jobs);
+
+    jobs.add(JobQueue::JOB_ZONE_SYNC, 100, 0);
+    jobs.add(JobQueue::JOB_ZONE_SYNC, 100, 80);
+
+    EXPECT(jobs.getStats().queued == 1);
+    EXPECT(jobs.getStats().coalesced == 1);
+    EXPECT(jobs.next(&type, &job, 150) && type == JobQueue::JOB_ZONE_SYNC);
+    EXPECT(job.queuedTime == 0);
+    EXPECT(expiredCount[JobQueue::JOB_ZONE_SYNC] == 0);
+}
+
+static void testExpiredJob() {
+    JobQueue jobs;
+    JobQueue::JOB_TYPE type;
+    JobQueue::JOB job;
+    reset(&jobs);
+
+    // Due exactly at the deadline, expired after it
+    jobs.add(JobQueue::JOB_ARM, 100, 0);
+    jobs.expire(100);
+    EXPECT(jobs.isPending(JobQueue::JOB_ARM));
+    jobs.expire(101);
+    EXPECT(!jobs.isPending(JobQueue::JOB_ARM));
+    EXPECT(expiredCount[JobQueue::JOB_ARM] == 1);
+    EXPECT(jobs.getStats().expired == 1);
+
+    // next() reports an expired job and moves on to one still in time
+    jobs.add(JobQueue::JOB_DISARM, 100, 0);
+    jobs.add(JobQueue::JOB_TIME_SYNC, 1000, 0);
+    EXPECT(jobs.next(&type, &job, 200) && type == JobQueue::JOB_TIME_SYNC);
+    EXPECT(expiredCount[JobQueue::JOB_DISARM] == 1);
+
+    // As does take()
+    jobs.add(JobQueue::JOB_ZONE_SYNC, 100, 0);
+    EXPECT(!jobs.take(JobQueue::JOB_ZONE_SYNC, 200));
+    EXPECT(expiredCount[JobQueue::JOB_ZONE_SYNC] == 1);
+
+    // Deadlines are compared across millis() wrapping
+    jobs.add(JobQueue::JOB_ARM, 100, 0xFFFFFFC0);
+    jobs.expire(10);
+    EXPECT(jobs.isPending(JobQueue::JOB_ARM));
+    jobs.expire(50);
+    EXPECT(expiredCount[JobQueue::JOB_ARM] == 2);
+
+    // Reported once only
+    jobs.expire(1000);
+    EXPECT(jobs.getStats().expired == 4);
+    EXPECT(jobs.isEmpty());
+}
+
+int main() {
+    testPriority();
+    testCoalesce();
+    testExpiredJob();
+
+    if (failures > 0)
+        return 1;
+
+    printf("All job queue tests passed\n");
+    return 0;
+}
@@ -0,0 +1,169 @@
+// Copyright 2020 Kevin Cooper
+//
+// CrestronMatcher tests
+//
+// Checks the bucketed matcher against a plain first-match scan of the same
+// patterns, including screen texts that are prefixes of one another.
+//
+// Build:   g++ -std=c++14 -O2 -I../TexecomApplication/src -o matchertest
+//              matchertest.cpp ../TexecomApplication/src/crestronmatcher.cpp
+// Run:     ./matchertest   (exits non-zero on the first failure)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crestronmatcher.h"
+
+typedef CrestronMatcher::MESSAGE_TYPE MESSAGE_TYPE;
+
+static int failures = 0;
+
+static void expect(CrestronMatcher *matcher, const char *message, MESSAGE_TYPE expected) {
+    MESSAGE_TYPE type = matcher->classify(message, strlen(message));
+    if (type != expected) {
+        printf("FAIL: %s classified %d, expected %d\n", message, type, expected);
+        failures++;
+    }
+}
+
+// The matcher tries events then screens in config order, so the first of
+// those that matches is the answer
+static MESSAGE_TYPE referenceClassify(const CrestronMatcher::SCREEN_CONFIG *config, const char *message) {
+    static const struct {
+        const char *text;
+        uint8_t minLength;
+        uint8_t maxLength;
+        MESSAGE_TYPE type;
+    } events[] = {
+        { "Z0", 6, 6, CrestronMatcher::MESSAGE_ZONE_UPDATE },
+        { "A0", 6, 255, CrestronMatcher::MESSAGE_ARM_UPDATE },
+        { "D0", 6, 255, CrestronMatcher::MESSAGE_DISARM_UPDATE },
+        { "E0", 6, 6, CrestronMatcher::MESSAGE_ENTRY_UPDATE },
+        { "X0", 6, 6, CrestronMatcher::MESSAGE_ARMING_UPDATE },
+        { "L0", 6, 6, CrestronMatcher::MESSAGE_INTRUDER_UPDATE },
+        { "U0", 6, 6, CrestronMatcher::MESSAGE_USER_LOGIN },
+        { "T0", 6, 6, CrestronMatcher::MESSAGE_USER_LOGIN },
+        { "N", 5, 5, CrestronMatcher::MESSAGE_REPLY_DISARMED },
+        { "Y", 5, 5, CrestronMatcher::MESSAGE_REPLY_ARMED },
+    };
+    static const MESSAGE_TYPE screenTypes[CrestronMatcher::SCREEN_COUNT] = {
+        CrestronMatcher::MESSAGE_SCREEN_IDLE,
+        CrestronMatcher::MESSAGE_SCREEN_PART_ARMED,
+        CrestronMatcher::MESSAGE_SCREEN_PART_ARMED,
+        CrestronMatcher::MESSAGE_SCREEN_PART_ARMED,
+        CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED,
+        CrestronMatcher::MESSAGE_WELCOME_BACK,
+        CrestronMatcher::MESSAGE_QUESTION_ARM,
+        CrestronMatcher::MESSAGE_QUESTION_PART_ARM,
+        CrestronMatcher::MESSAGE_QUESTION_NIGHT_ARM,
+        CrestronMatcher::MESSAGE_QUESTION_DISARM,
+        CrestronMatcher::MESSAGE_SCREEN_AREA_ENTRY,
+        CrestronMatcher::MESSAGE_SCREEN_AREA_EXIT,
+        CrestronMatcher::MESSAGE_SCREEN_INVALID_CODE,
+    };
+
+    size_t length = strlen(message);
+    if (length < 2 || message[0] != '"')
+        return CrestronMatcher::MESSAGE_UNKNOWN;
+
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+        if (strncmp(message + 1, events[i].text, strlen(events[i].text)) == 0 &&
+                length >= events[i].minLength && length <= events[i].maxLength)
+            return events[i].type;
+    }
+
+    for (uint8_t i = 0; i < CrestronMatcher::SCREEN_COUNT; i++) {
+        size_t textLength = strlen(config->text[i]);
+        size_t minLength = textLength + 1 + (i == CrestronMatcher::SCREEN_WELCOME_BACK ? 1 : 0);
+        if (textLength > 0 && strncmp(message + 1, config->text[i], textLength) == 0 && length >= minLength)
+            return screenTypes[i];
+    }
+
+    return CrestronMatcher::MESSAGE_UNKNOWN;
+}
+
+static void testDefaultScreens() {
+    CrestronMatcher::SCREEN_CONFIG config;
+    CrestronMatcher::getDefaultScreens(&config);
+    CrestronMatcher matcher;
+    matcher.begin(&config);
+
+    expect(&matcher, "\"Z0091", CrestronMatcher::MESSAGE_ZONE_UPDATE);
+    expect(&matcher, "\"A0011", CrestronMatcher::MESSAGE_ARM_UPDATE);
+    expect(&matcher, "\"Y001", CrestronMatcher::MESSAGE_REPLY_ARMED);
+    expect(&matcher, "\"Area FULL ARMED ", CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED);
+    expect(&matcher, "\"Area in Entry   ", CrestronMatcher::MESSAGE_SCREEN_AREA_ENTRY);
+    expect(&matcher, "\"Area in Exit >  ", CrestronMatcher::MESSAGE_SCREEN_AREA_EXIT);
+    expect(&matcher, "\"  Welcome Back     Kevin", CrestronMatcher::MESSAGE_WELCOME_BACK);
+    expect(&matcher, "\"  Welcome Back", CrestronMatcher::MESSAGE_UNKNOWN);
+    expect(&matcher, "\"Unrecognised screen", CrestronMatcher::MESSAGE_UNKNOWN);
+}
+
+// A screen text that is a prefix of one before it in the same bucket
+static void testPrefixScreens() {
+    CrestronMatcher::SCREEN_CONFIG config;
+    CrestronMatcher::getDefaultScreens(&config);
+    strcpy(config.text[CrestronMatcher::SCREEN_AREA_EXIT], "Area");
+    CrestronMatcher matcher;
+    matcher.begin(&config);
+
+    expect(&matcher, "\"Area in Exit >  ", CrestronMatcher::MESSAGE_SCREEN_AREA_EXIT);
+    expect(&matcher, "\"Area in Entry   ", CrestronMatcher::MESSAGE_SCREEN_AREA_ENTRY);
+    expect(&matcher, "\"Area FULL ARMED ", CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED);
+
+    // And the other way round, the shorter text first
+    CrestronMatcher::getDefaultScreens(&config);
+    strcpy(config.text[CrestronMatcher::SCREEN_ARMED_FULL], "Area");
+    matcher.begin(&config);
+
+    expect(&matcher, "\"Area in Exit >  ", CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED);
+}
+
+// Random screen texts from a small alphabet, so that shared prefixes and
+// texts that are prefixes of others are common
+static void testRandomScreens(uint32_t rounds) {
+    static const char alphabet[] = "AAB ";
+    char message[maxScreenLength + 8];
+    CrestronMatcher::SCREEN_CONFIG config;
+    CrestronMatcher matcher;
+
+    srand(1);
+
+    for (uint32_t round = 0; round < rounds; round++) {
+        memset(&config, 0, sizeof(config));
+        config.version = CrestronMatcher::screenConfigVersion;
+        for (uint8_t i = 0; i < CrestronMatcher::SCREEN_COUNT; i++) {
+            uint8_t length = rand() % 6;
+            for (uint8_t j = 0; j < length; j++)
+                config.text[i][j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        matcher.begin(&config);
+
+        for (uint8_t m = 0; m < 32; m++) {
+            uint8_t length = 1 + rand() % 8;
+            message[0] = '"';
+            for (uint8_t j = 1; j < length; j++)
+                message[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+            message[length] = '\0';
+
+            MESSAGE_TYPE expected = referenceClassify(&config, message);
+            expect(&matcher, message, expected);
+            if (failures > 0)
+                return;
+        }
+    }
+}
+
+int main() {
+    testDefaultScreens();
+    testPrefixScreens();
+    testRandomScreens(20000);
+
+    if (failures > 0)
+        return 1;
+
+    printf("All matcher tests passed\n");
+    return 0;
+}
@@ -0,0 +1,692 @@
+// Copyright 2020 Kevin Cooper
+//
+// Texecom panel simulator
+//
+// Emulates the parts of a Premier Elite panel that TexecomClass relies on,
+// over a pseudo-terminal, so the firmware's protocol handling can be
+// exercised and timed on a workstation.
+//
+// Build:   g++ -std=c++11 -O2 -o texecomsim texecomsim.cpp
+// Run:     ./texecomsim [options]   (prints the pty device to connect to)
+//
+// Options:
+//   --reply-delay <ms>      Delay before answering a command (default 20)
+//   --byte-gap <us>         Gap between transmitted bytes (default 0)
+//   --welcome-time <ms>     How long "Welcome Back" is shown after login (default 800)
+//   --exit-time <ms>        Exit delay before the area is armed (default 3000)
+//   --zone-interval <ms>    Push a random zone change this often, 0 = off (default 0)
+//   --zones <first> <count> Zones reported by the Simple protocol (default 9 11)
+//   --udl <code>            Simple protocol UDL code (default 123456)
+//   --user <pin> <name>     Add a user, the first is user 1 (default 1234 Kevin)
+//   --idle-screen <text>    Idle screen text (default "  The Cooper's")
+//   --replay <file>         Replay the received frames of a TXCP capture
+//
+// Commands on stdin:
+//   zone <zone> <state>     Set a zone healthy (0), active (1) or tamper (2)
+//   entry <zone>            Start an entry sequence from a zone
+//   alarm <zone>            Trigger the alarm from a zone
+//   arm | part | disarm     Change the arm state as if done from a keypad
+//   quit
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+static uint64_t nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+class PanelSimulator {
+ public:
+    typedef enum {
+        DISARMED = 0,
+        EXIT = 1,
+        ARMED_FULL = 2,
+        ARMED_PART = 3,
+        ENTRY = 4,
+        TRIGGERED = 5,
+    } ARM_STATE;
+
+    typedef enum {
+        SCREEN_IDLE,
+        SCREEN_WELCOME,
+        SCREEN_ARM_PROMPT,
+        SCREEN_PART_ARM_PROMPT,
+        SCREEN_NIGHT_ARM_PROMPT,
+        SCREEN_DISARM_PROMPT,
+        SCREEN_EXIT,
+        SCREEN_ENTRY,
+    } SCREEN;
+
+    struct CONFIG {
+        uint32_t replyDelay = 20;
+        uint32_t byteGap = 0;
+        uint32_t welcomeTime = 800;
+        uint32_t exitTime = 3000;
+        uint32_t zoneInterval = 0;
+        uint16_t firstZone = 9;
+        uint16_t zoneCount = 11;
+        std::string udlCode = "123456";
+        std::string idleScreen = "  The Cooper's";
+        std::vector<std::pair<std::string, std::string>> users;
+        const char *replayFile = NULL;
+    };
+
+ public:
+    explicit PanelSimulator(const CONFIG &config);
+    bool open();
+    void run();
+
+ private:
+    struct PENDING {
+        uint64_t due;
+        std::string data;
+        bool arms;        // Completes the exit delay when sent
+    };
+
+    void receive(uint8_t c);
+    void processCrestron(const std::string &command);
+    void processSimple(const std::string &command);
+    void processKey(char key);
+    void processConsole(const char *line);
+
+    void enqueue(const PENDING &pending);
+    void send(const std::string &frame, uint32_t delay);
+    void sendCrestron(const std::string &text, uint32_t delay);
+    void sendSimple(const std::string &payload, uint32_t delay);
+    void flush();
+    void tick();
+
+    void setScreen(SCREEN newScreen);
+    void updateScreen();
+    std::string screenText();
+    void setZone(uint16_t zone, uint8_t state);
+    void startArming(ARM_STATE target);
+    void disarm(uint8_t user);
+    void log(const char *format, ...);
+
+    CONFIG config;
+    int master = -1;
+    uint64_t startMicros;
+
+    // Receive state
+    std::string rxBuffer;
+    bool simpleMode = false;
+
+    // Transmit queue, sent in order once due
+    std::vector<PENDING> txQueue;
+
+    // Panel state
+    ARM_STATE armState = DISARMED;
+    ARM_STATE armTarget = DISARMED;
+    SCREEN screen = SCREEN_IDLE;
+    uint64_t screenChanged = 0;
+    uint8_t loggedInUser = 0;
+    std::string keyedDigits;
+    uint64_t keyTimingStart = 0;
+    std::map<uint16_t, uint8_t> zones;
+    uint64_t nextZoneChange = 0;
+
+    // Replay state
+    FILE *replay = NULL;
+    uint32_t replayLastMicros = 0;
+    uint64_t replayNextDue = 0;
+    std::string replayFrame;
+    bool readReplayRecord();
+};
+
+PanelSimulator::PanelSimulator(const CONFIG &config) : config(config) {
+    startMicros = nowMicros();
+    if (this->config.users.empty())
+        this->config.users.push_back(std::make_pair("1234", "Kevin"));
+    for (uint16_t i = 0; i < config.zoneCount; i++)
+        zones[config.firstZone + i] = 0;
+}
+
+void PanelSimulator::log(const char *format, ...) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    fprintf(stderr, "%10.3f %s\n", (nowMicros() - startMicros) / 1000.0, text);
+}
+
+bool PanelSimulator::open() {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("pty");
+        return false;
+    }
+
+    // Raw 8 bit, no echo, so binary Simple protocol payloads pass untouched
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    printf("%s\n", ptsname(master));
+    fflush(stdout);
+
+    if (config.replayFile) {
+        replay = fopen(config.replayFile, "rb");
+        uint8_t header[9];
+        if (!replay || fread(header, 1, sizeof(header), replay) != sizeof(header) ||
+                memcmp(header, "TXCP", 4) != 0) {
+            fprintf(stderr, "%s is not a TXCP capture\n", config.replayFile);
+            return false;
+        }
+        readReplayRecord();
+    }
+
+    if (config.zoneInterval)
+        nextZoneChange = nowMicros() + config.zoneInterval * 1000ULL;
+    return true;
+}
+
+//
+// Transmit
+//
+
+void PanelSimulator::enqueue(const PENDING &pending) {
+    // Ordered by due time, frames due together keep the order they were queued
+    std::vector<PENDING>::iterator position = txQueue.end();
+    while (position != txQueue.begin() && (position - 1)->due > pending.due)
+        position--;
+    txQueue.insert(position, pending);
+}
+
+void PanelSimulator::send(const std::string &frame, uint32_t delay) {
+    PENDING pending = { nowMicros() + delay * 1000ULL, frame, false };
+    enqueue(pending);
+}
+
+void PanelSimulator::sendCrestron(const std::string &text, uint32_t delay) {
+    send(text + "\r\n", delay);
+}
+
+void PanelSimulator::sendSimple(const std::string &payload, uint32_t delay) {
+    unsigned int a = 0;
+    for (size_t i = 0; i < payload.size(); i++)
+        a += (uint8_t) payload[i];
+    std::string frame = payload;
+    frame += (char) ((a ^ 255) % 0x100);
+    frame += "\r\n";
+    send(frame, delay);
+}
+
+void PanelSimulator::flush() {
+    uint64_t now = nowMicros();
+
+    while (!txQueue.empty() && txQueue.front().due <= now) {
+        PENDING pending = txQueue.front();
+        txQueue.erase(txQueue.begin());
+
+        for (size_t i = 0; i < pending.data.size(); i++) {
+            if (write(master, &pending.data[i], 1) != 1 && errno != EAGAIN)
+                return;
+            if (config.byteGap)
+                usleep(config.byteGap);
+        }
+
+        std::string printable = pending.data.substr(0, pending.data.size() - 2);
+        for (size_t i = 0; i < printable.size(); i++)
+            if (printable[i] < 32 || printable[i] > 126)
+                printable[i] = '.';
+        log("TX %s", printable.c_str());
+    }
+}
+
+//
+// Receive
+//
+
+void PanelSimulator::receive(uint8_t c) {
+    rxBuffer += (char) c;
+
+    if (!simpleMode && rxBuffer.size() >= 2 && rxBuffer[0] == '\\') {
+        // Simple protocol commands end with '/' and a checksum byte
+        if (rxBuffer.size() >= 3 && rxBuffer[rxBuffer.size()-2] == '/') {
+            processSimple(rxBuffer);
+            rxBuffer.clear();
+        }
+        return;
+    }
+
+    if (simpleMode) {
+        if (rxBuffer[0] != '\\') {
+            rxBuffer.clear();
+        } else if (rxBuffer.size() >= 3 && rxBuffer[rxBuffer.size()-2] == '/') {
+            // '/' can appear in binary arguments, so only accept a good checksum
+            unsigned int a = 0;
+            for (size_t i = 0; i < rxBuffer.size() - 1; i++)
+                a += (uint8_t) rxBuffer[i];
+            if ((char) ((a ^ 255) % 0x100) == rxBuffer.back()) {
+                processSimple(rxBuffer);
+                rxBuffer.clear();
+            }
+        }
+        return;
+    }
+
+    if (c == '\n') {
+        std::string command = rxBuffer;
+        while (!command.empty() && (command.back() == '\r' || command.back() == '\n'))
+            command.pop_back();
+        rxBuffer.clear();
+        if (!command.empty())
+            processCrestron(command);
+    }
+}
+
+void PanelSimulator::processCrestron(const std::string &command) {
+    log("RX %s", command.c_str());
+
+    if (command == "ASTATUS") {
+        bool armed = armState != DISARMED;
+        char reply[8];
+        snprintf(reply, sizeof(reply), "\"%c%03d", armed ? 'Y' : 'N', armed ? 1 : 0);
+        sendCrestron(reply, config.replyDelay);
+    } else if (command == "LSTATUS") {
+        sendCrestron("\"" + screenText(), config.replyDelay);
+    } else if (command.size() == 4 && command.compare(0, 3, "KEY") == 0) {
+        processKey(command[3]);
+    }
+}
+
+void PanelSimulator::processSimple(const std::string &command) {
+    // Strip the leading '\', trailing '/' and checksum
+    std::string body = command.substr(1, command.size() - 3);
+    char type = body.empty() ? 0 : body[0];
+
+    if (type == 'W') {
+        log("RX \\W (login)");
+        if (body.substr(1) == config.udlCode) {
+            simpleMode = true;
+            sendSimple("OK", config.replyDelay);
+        }
+        return;
+    }
+
+    if (!simpleMode)
+        return;
+
+    if (type == 'Z' && body.size() == 3) {
+        uint8_t first = body[1];
+        uint8_t count = body[2];
+        log("RX \\Z %d %d", first, count);
+        std::string reply;
+        for (uint16_t i = 0; i < count; i++) {
+            uint8_t state = zones.count(first + 1 + i) ? zones[first + 1 + i] : 0;
+            uint8_t flags = (state == 1 ? 0x01 : 0) | (state == 2 ? 0x02 : 0);
+            reply += (char) flags;
+            reply += (char) 0;
+        }
+        sendSimple(reply, config.replyDelay);
+    } else if (type == 'T' && body.size() == 2 && body[1] == '?') {
+        log("RX \\T?");
+        time_t t = time(NULL);
+        struct tm *local = localtime(&t);
+        std::string reply;
+        reply += (char) local->tm_mday;
+        reply += (char) (local->tm_mon + 1);
+        reply += (char) (local->tm_year - 100);
+        reply += (char) local->tm_hour;
+        reply += (char) local->tm_min;
+        sendSimple(reply, config.replyDelay);
+    } else if (type == 'T' && body.size() == 6) {
+        log("RX \\T (set time)");
+        sendSimple("OK", config.replyDelay);
+    } else if (type == 'H') {
+        log("RX \\H (logout)");
+        sendSimple("OK", config.replyDelay);
+        simpleMode = false;
+    } else {
+        log("RX unknown simple command %c", type);
+        sendSimple("ERROR", config.replyDelay);
+    }
+}
+
+void PanelSimulator::processKey(char key) {
+    log("RX KEY%c", key);
+
+    if (keyTimingStart == 0)
+        keyTimingStart = nowMicros();
+
+    if (key >= '0' && key <= '9') {
+        if (loggedInUser != 0)
+            return;
+
+        keyedDigits += key;
+        for (size_t i = 0; i < config.users.size(); i++) {
+            if (keyedDigits == config.users[i].first) {
+                loggedInUser = i + 1;
+                keyedDigits.clear();
+                char frame[12];
+                snprintf(frame, sizeof(frame), "\"U%03d1", loggedInUser);
+                sendCrestron(frame, config.replyDelay);
+                setScreen(SCREEN_WELCOME);
+                return;
+            }
+        }
+
+        // Like the real panel, a wrong code gives no notification
+        if (keyedDigits.size() >= 8)
+            keyedDigits.clear();
+        return;
+    }
+
+    if (key == 'R') {
+        keyedDigits.clear();
+        loggedInUser = 0;
+        keyTimingStart = 0;
+        setScreen(armState == ENTRY ? SCREEN_ENTRY : SCREEN_IDLE);
+        return;
+    }
+
+    // Prompts only respond once the welcome screen has gone
+    updateScreen();
+
+    if (key == 'Y') {
+        if (screen == SCREEN_ARM_PROMPT) {
+            startArming(ARMED_FULL);
+        } else if (screen == SCREEN_PART_ARM_PROMPT) {
+            setScreen(SCREEN_NIGHT_ARM_PROMPT);
+        } else if (screen == SCREEN_NIGHT_ARM_PROMPT) {
+            startArming(ARMED_PART);
+        } else if (screen == SCREEN_DISARM_PROMPT) {
+            disarm(loggedInUser);
+        }
+    } else if (key == 'D') {
+        if (screen == SCREEN_ARM_PROMPT)
+            setScreen(SCREEN_PART_ARM_PROMPT);
+    }
+}
+
+//
+// Panel state
+//
+
+void PanelSimulator::setScreen(SCREEN newScreen) {
+    screen = newScreen;
+    screenChanged = nowMicros();
+}
+
+void PanelSimulator::updateScreen() {
+    // The welcome screen gives way to the arm or disarm question
+    if (screen == SCREEN_WELCOME &&
+            nowMicros() - screenChanged >= config.welcomeTime * 1000ULL)
+        setScreen(armState == DISARMED ? SCREEN_ARM_PROMPT : SCREEN_DISARM_PROMPT);
+}
+
+std::string PanelSimulator::screenText() {
+    updateScreen();
+
+    switch (screen) {
+        case SCREEN_WELCOME :
+            return "  Welcome Back     " + config.users[loggedInUser-1].second;
+        case SCREEN_ARM_PROMPT :
+            return "Do you want to  Arm System?";
+        case SCREEN_PART_ARM_PROMPT :
+            return "Do you want to  Part Arm System?";
+        case SCREEN_NIGHT_ARM_PROMPT :
+            return "Do you want:-   Night Arm";
+        case SCREEN_DISARM_PROMPT :
+            return "Do you want to  Disarm System?";
+        case SCREEN_EXIT :
+            return "Area in Exit >  ";
+        case SCREEN_ENTRY :
+            return "Area in Entry   ";
+        case SCREEN_IDLE :
+        default :
+            if (armState == ARMED_FULL)
+                return "Area FULL ARMED ";
+            else if (armState == ARMED_PART)
+                return " * PART ARMED * ";
+            return config.idleScreen;
+    }
+}
+
+void PanelSimulator::startArming(ARM_STATE target) {
+    char frame[12];
+    snprintf(frame, sizeof(frame), "\"X%03d1", loggedInUser);
+    sendCrestron(frame, config.replyDelay);
+
+    armState = EXIT;
+    armTarget = target;
+    setScreen(SCREEN_EXIT);
+
+    // Armed once the exit delay has run
+    snprintf(frame, sizeof(frame), "\"A%03d1", loggedInUser);
+    PENDING armed = { nowMicros() + config.exitTime * 1000ULL, std::string(frame) + "\r\n", true };
+    enqueue(armed);
+
+    if (keyTimingStart)
+        log("Arming %.1fms after first key", (nowMicros() - keyTimingStart) / 1000.0);
+    loggedInUser = 0;
+    keyTimingStart = 0;
+}
+
+void PanelSimulator::disarm(uint8_t user) {
+    char frame[12];
+    snprintf(frame, sizeof(frame), "\"D%03d1", user);
+    sendCrestron(frame, config.replyDelay);
+
+    // Cancel a pending exit delay
+    for (size_t i = 0; i < txQueue.size(); i++)
+        if (txQueue[i].arms)
+            txQueue.erase(txQueue.begin() + i--);
+
+    armState = DISARMED;
+    setScreen(SCREEN_IDLE);
+
+    if (keyTimingStart)
+        log("Disarmed %.1fms after first key", (nowMicros() - keyTimingStart) / 1000.0);
+    loggedInUser = 0;
+    keyTimingStart = 0;
+}
+
+void PanelSimulator::setZone(uint16_t zone, uint8_t state) {
+    zones[zone] = state;
+    char frame[12];
+    snprintf(frame, sizeof(frame), "\"Z%03d%d", zone, state);
+    sendCrestron(frame, 0);
+}
+
+void PanelSimulator::processConsole(const char *line) {
+    char command[16];
+    int zone = 0;
+    int state = 0;
+    int fields = sscanf(line, "%15s %d %d", command, &zone, &state);
+    if (fields < 1)
+        return;
+
+    if (strcmp(command, "zone") == 0 && fields == 3) {
+        setZone(zone, state);
+    } else if (strcmp(command, "entry") == 0 && fields >= 2) {
+        setZone(zone, 1);
+        armState = ENTRY;
+        setScreen(SCREEN_ENTRY);
+        char frame[12];
+        snprintf(frame, sizeof(frame), "\"E%03d1", zone);
+        sendCrestron(frame, 0);
+    } else if (strcmp(command, "alarm") == 0 && fields >= 2) {
+        setZone(zone, 1);
+        armState = TRIGGERED;
+        char frame[12];
+        snprintf(frame, sizeof(frame), "\"L%03d1", zone);
+        sendCrestron(frame, 0);
+    } else if (strcmp(command, "arm") == 0 || strcmp(command, "part") == 0) {
+        startArming(command[0] == 'a' ? ARMED_FULL : ARMED_PART);
+    } else if (strcmp(command, "disarm") == 0) {
+        disarm(0);
+    } else if (strcmp(command, "quit") == 0) {
+        exit(0);
+    } else {
+        fprintf(stderr, "Unknown command\n");
+    }
+}
+
+//
+// Replay
+//
+
+bool PanelSimulator::readReplayRecord() {
+    uint8_t header[6];
+    while (fread(header, 1, sizeof(header), replay) == sizeof(header)) {
+        uint32_t micros;
+        memcpy(&micros, header, 4);
+        uint8_t flags = header[4];
+        uint8_t length = header[5];
+
+        char data[256];
+        if (fread(data, 1, length, replay) != length)
+            break;
+
+        // Only the panel's side of the conversation is replayed
+        if (flags & 0x01)
+            continue;
+
+        uint64_t gap = replayLastMicros ? (uint32_t) (micros - replayLastMicros) : 0;
+        replayLastMicros = micros;
+        replayNextDue = nowMicros() + gap;
+        replayFrame.assign(data, length);
+
+        // Simple frames were captured without their checksum and CRLF
+        if (flags & 0x02) {
+            unsigned int a = 0;
+            for (size_t i = 0; i < replayFrame.size(); i++)
+                a += (uint8_t) replayFrame[i];
+            replayFrame += (char) ((a ^ 255) % 0x100);
+        }
+        replayFrame += "\r\n";
+        return true;
+    }
+
+    log("Replay complete");
+    fclose(replay);
+    replay = NULL;
+    return false;
+}
+
+void PanelSimulator::tick() {
+    uint64_t now = nowMicros();
+
+    if (replay && now >= replayNextDue) {
+        PENDING pending = { now, replayFrame, false };
+        enqueue(pending);
+        readReplayRecord();
+    }
+
+    if (nextZoneChange && now >= nextZoneChange) {
+        nextZoneChange = now + config.zoneInterval * 1000ULL;
+        uint16_t zone = config.firstZone + rand() % config.zoneCount;
+        setZone(zone, zones[zone] ? 0 : 1);
+    }
+
+    // Exit delay finished
+    for (size_t i = 0; i < txQueue.size(); i++) {
+        if (txQueue[i].arms && txQueue[i].due <= now) {
+            armState = armTarget;
+            if (screen == SCREEN_EXIT)
+                setScreen(SCREEN_IDLE);
+        }
+    }
+
+    flush();
+}
+
+void PanelSimulator::run() {
+    char console[128];
+    size_t consoleLength = 0;
+
+    while (true) {
+        struct pollfd fds[2];
+        fds[0].fd = master;
+        fds[0].events = POLLIN;
+        fds[1].fd = STDIN_FILENO;
+        fds[1].events = POLLIN;
+
+        poll(fds, 2, 1);
+
+        if (fds[0].revents & POLLIN) {
+            uint8_t data[64];
+            ssize_t length = read(master, data, sizeof(data));
+            for (ssize_t i = 0; i < length; i++)
+                receive(data[i]);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char c;
+            if (read(STDIN_FILENO, &c, 1) == 1) {
+                if (c == '\n') {
+                    console[consoleLength] = '\0';
+                    processConsole(console);
+                    consoleLength = 0;
+                } else if (consoleLength < sizeof(console) - 1) {
+                    console[consoleLength++] = c;
+                }
+            }
+        }
+
+        tick();
+    }
+}
+
+int main(int argc, char **argv) {
+    PanelSimulator::CONFIG config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--reply-delay" && hasValue) {
+            config.replyDelay = atoi(argv[++i]);
+        } else if (arg == "--byte-gap" && hasValue) {
+            config.byteGap = atoi(argv[++i]);
+        } else if (arg == "--welcome-time" && hasValue) {
+            config.welcomeTime = atoi(argv[++i]);
+        } else if (arg == "--exit-time" && hasValue) {
+            config.exitTime = atoi(argv[++i]);
+        } else if (arg == "--zone-interval" && hasValue) {
+            config.zoneInterval = atoi(argv[++i]);
+        } else if (arg == "--zones" && i + 2 < argc) {
+            config.firstZone = atoi(argv[++i]);
+            config.zoneCount = atoi(argv[++i]);
+        } else if (arg == "--udl" && hasValue) {
+            config.udlCode = argv[++i];
+        } else if (arg == "--user" && i + 2 < argc) {
+            config.users.push_back(std::make_pair(argv[i+1], argv[i+2]));
+            i += 2;
+        } else if (arg == "--idle-screen" && hasValue) {
+            config.idleScreen = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            config.replayFile = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    PanelSimulator simulator(config);
+    if (!simulator.open())
+        return 1;
+
+    simulator.run();
+    return 0;
+}
@@ -7,19 +7,91 @@
 
 #define texSerial Serial1
 
+#define commandQueueSize 16
+
 class CrestronHelper {
  public:
     typedef enum {
         COMMAND_ARMED_STATE = 0,
-        COMMAND_SCREEN_STATE = 1
+        COMMAND_SCREEN_STATE = 1,
+        COMMAND_KEY = 2
     } CRESTRON_COMMAND;
 
+    struct OUTSTANDING_REQUEST {
+        bool waiting;
+        bool retransmitted; // Reply can't be matched to one send, so no RTT sample
+        uint8_t attempts;
+        uint32_t sentTime;
+        uint32_t timeout;
+    };
+
+    // Smoothed round trip and its mean deviation, as TCP does for its
+    // retransmit timeout. Keys are timed to the event they cause
+    struct RTT_ESTIMATE {
+        int32_t smoothed;   // milliseconds, 0 = no sample yet
+        int32_t deviation;
+        uint32_t timeout;
+    };
+
+    struct LINK_STATS {
+        uint32_t retransmits;
+        uint32_t failures;
+    };
+
+    struct QUEUED_COMMAND {
+        CRESTRON_COMMAND command;
+        char key;
+        bool secret;        // Part of a user code, so never recorded
+        uint32_t sendAfter;
+        void (*onSent)();
+    };
+
  public:
     CrestronHelper();
-    void request(CRESTRON_COMMAND command);
+    void loop();
+    void request(CRESTRON_COMMAND command, uint32_t delay = 0);
     void requestArmState();
     void requestScreen();
+    bool sendKey(char key, uint32_t delay = 0, void (*onSent)() = NULL, bool secret = false);
+    void clearQueue();
+    void cancel(CRESTRON_COMMAND command);
+    uint8_t queuedCommands() { return queueCount; }
+    uint32_t lastKeyTime() { return lastKeySent; }
+    bool isOutstanding(CRESTRON_COMMAND command);
+    bool matchReply(CRESTRON_COMMAND command);
+    void matchKeyResponse();
+    bool takeFailure(CRESTRON_COMMAND *command);
+    void setRetryPolicy(uint32_t maxTimeout, uint8_t maxRetries);
+    static void updateEstimate(RTT_ESTIMATE *estimate, uint32_t roundTrip,
+                                uint32_t minTimeout, uint32_t maxTimeout);
+    uint32_t getTimeout(CRESTRON_COMMAND command) { return estimates[command].timeout; }
+    const RTT_ESTIMATE& getEstimate(CRESTRON_COMMAND command) { return estimates[command]; }
+    const LINK_STATS& getStats() { return stats; }
  private:
+    bool queue(CRESTRON_COMMAND command, char key, uint32_t delay, void (*onSent)(), bool secret = false);
+    bool send(const QUEUED_COMMAND *entry);
+    void sampleRoundTrip(CRESTRON_COMMAND command, uint32_t roundTrip);
+    void checkRetransmits();
+
+    // Commands are sent in order, each no earlier than its sendAfter time
+    // and at least commandSpacing after the previous one
+    QUEUED_COMMAND commandQueue[commandQueueSize];
+    uint8_t queueHead = 0;
+    uint8_t queueCount = 0;
+    uint32_t lastCommandTime = 0;
+    uint32_t lastKeySent = 0;
+
+    // ASTATUS and LSTATUS replies can be told apart, so one of each may be
+    // in flight at once. Indexed by command
+    OUTSTANDING_REQUEST outstanding[COMMAND_KEY];
+    RTT_ESTIMATE estimates[COMMAND_KEY + 1];
+    uint32_t maxTimeout = 2000;
+    uint8_t maxRetries = 3;
+    const uint32_t minTimeout[COMMAND_KEY + 1] = {100, 100, 300};
+    bool failed = false;
+    CRESTRON_COMMAND failedCommand;
+    LINK_STATS stats;
+    const uint32_t commandSpacing = 20;
 };
 
- #endif  //__CRESTRONHELPER_H_
\ No newline at end of file
+ #endif  //__CRESTRONHELPER_H_
@@ -1,14 +1,223 @@
 #include "crestonhelper.h"
+#include "serialrecorder.h"
 
-CrestronHelper::CrestronHelper() {}
+CrestronHelper::CrestronHelper() {
+    memset(outstanding, 0, sizeof(outstanding));
+    memset(&stats, 0, sizeof(stats));
+    setRetryPolicy(maxTimeout, maxRetries);
+}
+
+// Until the first sample every command waits the full maxTimeout
+void CrestronHelper::setRetryPolicy(uint32_t maxTimeout, uint8_t maxRetries) {
+    this->maxTimeout = maxTimeout;
+    this->maxRetries = maxRetries;
+
+    for (uint8_t i = 0; i <= COMMAND_KEY; i++) {
+        estimates[i].smoothed = 0;
+        estimates[i].deviation = 0;
+        estimates[i].timeout = maxTimeout;
+    }
+}
+
+void CrestronHelper::sampleRoundTrip(CRESTRON_COMMAND command, uint32_t roundTrip) {
+    updateEstimate(&estimates[command], roundTrip, minTimeout[command], maxTimeout);
+}
+
+void CrestronHelper::updateEstimate(RTT_ESTIMATE *estimate, uint32_t roundTrip,
+                                    uint32_t minTimeout, uint32_t maxTimeout) {
+    int32_t sample = roundTrip;
 
-void CrestronHelper::request(CRESTRON_COMMAND command) {
-    if (command == COMMAND_SCREEN_STATE)
-        texSerial.println("LSTATUS");
-    else if (command == COMMAND_ARMED_STATE) {
-        texSerial.println("ASTATUS");
+    if (estimate->smoothed == 0) {
+        estimate->smoothed = sample;
+        estimate->deviation = sample / 2;
+    } else {
+        int32_t error = sample - estimate->smoothed;
+        estimate->deviation += (abs(error) - estimate->deviation) / 4;
+        estimate->smoothed += error / 8;
     }
-    // lastCommandTime = millis();
+
+    uint32_t timeout = estimate->smoothed + 4 * estimate->deviation;
+    estimate->timeout = constrain(timeout, minTimeout, maxTimeout);
+}
+
+bool CrestronHelper::queue(CRESTRON_COMMAND command, char key, uint32_t delay, void (*onSent)(), bool secret) {
+    uint32_t sendAfter = millis() + delay;
+
+    // A status request that is already waiting is rescheduled rather than
+    // sent twice
+    if (command != COMMAND_KEY) {
+        for (uint8_t i = 0; i < queueCount; i++) {
+            QUEUED_COMMAND *entry = &commandQueue[(queueHead + i) % commandQueueSize];
+            if (entry->command == command) {
+                entry->sendAfter = sendAfter;
+                entry->onSent = onSent;
+                return true;
+            }
+        }
+    }
+
+    if (queueCount >= commandQueueSize) {
+        Log.error("Command queue full");
+        return false;
+    }
+
+    QUEUED_COMMAND *entry = &commandQueue[(queueHead + queueCount) % commandQueueSize];
+    entry->command = command;
+    entry->key = key;
+    entry->secret = secret;
+    entry->sendAfter = sendAfter;
+    entry->onSent = onSent;
+    queueCount++;
+    return true;
+}
+
+bool CrestronHelper::send(const QUEUED_COMMAND *entry) {
+    // Never block the loop waiting for room in the UART TX buffer
+    if (texSerial.availableForWrite() < 9)
+        return false;
+
+    char command[8];
+
+    if (entry->command == COMMAND_SCREEN_STATE) {
+        strcpy(command, "LSTATUS");
+    } else if (entry->command == COMMAND_ARMED_STATE) {
+        strcpy(command, "ASTATUS");
+    } else if (entry->command == COMMAND_KEY) {
+        snprintf(command, sizeof(command), "KEY%c", entry->key);
+    } else {
+        return true;
+    }
+
+    texSerial.println(command);
+
+    // Keep the timing and length of a user code digit but not the digit
+    if (entry->secret)
+        command[3] = '*';
+    Recorder.record(SerialRecorder::RECORD_TX, SerialRecorder::RECORD_CRESTRON, command, strlen(command));
+    return true;
+}
+
+// Resend a status request whose reply is overdue, backing off each time,
+// until maxRetries have gone unanswered
+void CrestronHelper::checkRetransmits() {
+    for (uint8_t i = 0; i < COMMAND_KEY; i++) {
+        OUTSTANDING_REQUEST *request = &outstanding[i];
+
+        if (!request->waiting || millis() - request->sentTime < request->timeout)
+            continue;
+
+        if (request->attempts >= maxRetries) {
+            request->waiting = false;
+            failed = true;
+            failedCommand = (CRESTRON_COMMAND) i;
+            stats.failures++;
+            continue;
+        }
+
+        request->attempts++;
+        request->timeout = min(request->timeout * 2, maxTimeout);
+        request->sentTime = millis();  // Not due again until resent and overdue
+        stats.retransmits++;
+        queue((CRESTRON_COMMAND) i, 0, 0, NULL);
+    }
+}
+
+void CrestronHelper::loop() {
+    checkRetransmits();
+
+    if (queueCount == 0)
+        return;
+
+    QUEUED_COMMAND *entry = &commandQueue[queueHead];
+
+    if (millis() < entry->sendAfter ||
+        millis() < lastCommandTime + commandSpacing)
+        return;
+
+    if (!send(entry))
+        return;
+
+    lastCommandTime = millis();
+    if (entry->command == COMMAND_KEY) {
+        lastKeySent = lastCommandTime;
+    } else {
+        OUTSTANDING_REQUEST *request = &outstanding[entry->command];
+
+        // Sent again before the reply, so the reply could be to either
+        if (request->waiting) {
+            request->retransmitted = true;
+        } else {
+            request->waiting = true;
+            request->retransmitted = false;
+            request->attempts = 0;
+            request->timeout = estimates[entry->command].timeout;
+        }
+        request->sentTime = lastCommandTime;
+    }
+
+    void (*onSent)() = entry->onSent;
+    queueHead = (queueHead + 1) % commandQueueSize;
+    queueCount--;
+
+    if (onSent)
+        onSent();
+}
+
+void CrestronHelper::clearQueue() {
+    queueHead = 0;
+    queueCount = 0;
+    memset(outstanding, 0, sizeof(outstanding));
+    failed = false;
+}
+
+bool CrestronHelper::isOutstanding(CRESTRON_COMMAND command) {
+    return command != COMMAND_KEY && outstanding[command].waiting;
+}
+
+// Called for every reply of the command's type. Returns false when nothing
+// was waiting for it, e.g. a screen the panel pushed on its own
+bool CrestronHelper::matchReply(CRESTRON_COMMAND command) {
+    if (!isOutstanding(command))
+        return false;
+
+    outstanding[command].waiting = false;
+    if (!outstanding[command].retransmitted)
+        sampleRoundTrip(command, millis() - outstanding[command].sentTime);
+    return true;
+}
+
+// Called when the event a key press was waiting for arrives
+void CrestronHelper::matchKeyResponse() {
+    if (lastKeySent != 0)
+        sampleRoundTrip(COMMAND_KEY, millis() - lastKeySent);
+}
+
+// Returns true once for each request that ran out of retries
+bool CrestronHelper::takeFailure(CRESTRON_COMMAND *command) {
+    if (!failed)
+        return false;
+
+    failed = false;
+    *command = failedCommand;
+    return true;
+}
+
+// Drop a status request that is still waiting to be sent
+void CrestronHelper::cancel(CRESTRON_COMMAND command) {
+    for (uint8_t i = 0; i < queueCount; i++) {
+        uint8_t slot = (queueHead + i) % commandQueueSize;
+        if (commandQueue[slot].command != command)
+            continue;
+
+        for (uint8_t j = i; j < queueCount - 1; j++)
+            commandQueue[(queueHead + j) % commandQueueSize] = commandQueue[(queueHead + j + 1) % commandQueueSize];
+        queueCount--;
+        return;
+    }
+}
+
+void CrestronHelper::request(CRESTRON_COMMAND command, uint32_t delay) {
+    queue(command, 0, delay, NULL);
 }
 
 void CrestronHelper::requestArmState() {
@@ -17,4 +226,8 @@ void CrestronHelper::requestArmState() {
 
 void CrestronHelper::requestScreen() {
     request(COMMAND_SCREEN_STATE);
-}
\ No newline at end of file
+}
+
+bool CrestronHelper::sendKey(char key, uint32_t delay, void (*onSent)(), bool secret) {
+    return queue(COMMAND_KEY, key, delay, onSent, secret);
+}
@@ -0,0 +1,172 @@
+// Copyright 2020 Kevin Cooper
+
+#include "crestronmatcher.h"
+
+#define MATCH_EXACT(text, frameLength, type) { text, sizeof(text) - 1, frameLength, frameLength, type }
+#define MATCH_AT_LEAST(text, frameLength, type) { text, sizeof(text) - 1, frameLength, 255, type }
+
+// Fixed by the protocol. Within a bucket these are tried before screens
+static const CrestronMatcher::PATTERN eventPatterns[] = {
+    MATCH_EXACT("Z0", 6, CrestronMatcher::MESSAGE_ZONE_UPDATE),
+    MATCH_AT_LEAST("A0", 6, CrestronMatcher::MESSAGE_ARM_UPDATE),
+    MATCH_AT_LEAST("D0", 6, CrestronMatcher::MESSAGE_DISARM_UPDATE),
+    MATCH_EXACT("E0", 6, CrestronMatcher::MESSAGE_ENTRY_UPDATE),
+    MATCH_EXACT("X0", 6, CrestronMatcher::MESSAGE_ARMING_UPDATE),
+    MATCH_EXACT("L0", 6, CrestronMatcher::MESSAGE_INTRUDER_UPDATE),
+    MATCH_EXACT("U0", 6, CrestronMatcher::MESSAGE_USER_LOGIN),
+    MATCH_EXACT("T0", 6, CrestronMatcher::MESSAGE_USER_LOGIN),
+    MATCH_EXACT("N", 5, CrestronMatcher::MESSAGE_REPLY_DISARMED),
+    MATCH_EXACT("Y", 5, CrestronMatcher::MESSAGE_REPLY_ARMED),
+};
+
+static const struct {
+    const char *name;
+    const char *text;
+    CrestronMatcher::MESSAGE_TYPE type;
+} screens[CrestronMatcher::SCREEN_COUNT] = {
+    { "idle", "  The Cooper's", CrestronMatcher::MESSAGE_SCREEN_IDLE },
+    { "idlepart", " * PART ARMED *", CrestronMatcher::MESSAGE_SCREEN_PART_ARMED },
+    { "part", "Part", CrestronMatcher::MESSAGE_SCREEN_PART_ARMED },
+    { "night", "Night", CrestronMatcher::MESSAGE_SCREEN_PART_ARMED },
+    { "full", "Area FULL ARMED", CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED },
+    { "welcome", "  Welcome Back", CrestronMatcher::MESSAGE_WELCOME_BACK },
+    { "arm", "Do you want to  Arm System?", CrestronMatcher::MESSAGE_QUESTION_ARM },
+    { "partarm", "Do you want to  Part Arm System?", CrestronMatcher::MESSAGE_QUESTION_PART_ARM },
+    { "nightarm", "Do you want:-   Night Arm", CrestronMatcher::MESSAGE_QUESTION_NIGHT_ARM },
+    { "disarm", "Do you want to  Disarm System?", CrestronMatcher::MESSAGE_QUESTION_DISARM },
+    { "entry", "Area in Entry", CrestronMatcher::MESSAGE_SCREEN_AREA_ENTRY },
+    { "exit", "Area in Exit >", CrestronMatcher::MESSAGE_SCREEN_AREA_EXIT },
+    // Not every panel shows one, so off until set
+    { "invalid", "", CrestronMatcher::MESSAGE_SCREEN_INVALID_CODE },
+};
+
+CrestronMatcher::CrestronMatcher() {}
+
+void CrestronMatcher::getDefaultScreens(SCREEN_CONFIG *config) {
+    memset(config, 0, sizeof(SCREEN_CONFIG));
+    config->version = screenConfigVersion;
+    for (uint8_t i = 0; i < SCREEN_COUNT; i++)
+        strncpy(config->text[i], screens[i].text, maxScreenLength);
+}
+
+// Screens added since the config was saved take their defaults. Returns
+// false if it isn't a config this version understands
+bool CrestronMatcher::upgradeScreens(SCREEN_CONFIG *config) {
+    static const uint8_t screensInVersion[screenConfigVersion + 1] = { 0, SCREEN_INVALID_CODE, SCREEN_COUNT };
+
+    if (config->version == 0 || config->version > screenConfigVersion)
+        return false;
+
+    for (uint8_t i = screensInVersion[config->version]; i < SCREEN_COUNT; i++) {
+        strncpy(config->text[i], screens[i].text, maxScreenLength);
+        config->text[i][maxScreenLength] = '\0';
+    }
+
+    config->version = screenConfigVersion;
+    return true;
+}
+
+int CrestronMatcher::findScreen(const char *name) {
+    for (uint8_t i = 0; i < SCREEN_COUNT; i++) {
+        if (strcmp(name, screens[i].name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void addPattern(CrestronMatcher::PATTERN *pending, uint8_t *count, const CrestronMatcher::PATTERN &pattern) {
+    if (pattern.length == 0 || *count >= CrestronMatcher::maxPatterns ||
+            (uint8_t) (pattern.text[0] - CrestronMatcher::firstBucket) >= CrestronMatcher::bucketCount)
+        return;
+
+    pending[(*count)++] = pattern;
+}
+
+void CrestronMatcher::begin(const SCREEN_CONFIG *config) {
+    PATTERN pending[maxPatterns];
+    patternCount = 0;
+
+    for (uint8_t i = 0; i < sizeof(eventPatterns) / sizeof(eventPatterns[0]); i++)
+        addPattern(pending, &patternCount, eventPatterns[i]);
+
+    // Screens are matched as prefixes of the frame after the leading '"'.
+    // Welcome Back is always followed by the user's name
+    for (uint8_t i = 0; i < SCREEN_COUNT; i++) {
+        uint8_t length = strnlen(config->text[i], maxScreenLength);
+        uint8_t minLength = length + 1 + (i == SCREEN_WELCOME_BACK ? 1 : 0);
+        PATTERN pattern = { config->text[i], length, minLength, 255, screens[i].type };
+        addPattern(pending, &patternCount, pattern);
+    }
+
+    // Counting sort of the patterns by bucket, keeping their order, so each
+    // bucket is a contiguous run of patterns
+    uint8_t filled[bucketCount];
+    memset(bucketStart, 0, sizeof(bucketStart));
+    memset(filled, 0, sizeof(filled));
+
+    for (uint8_t i = 0; i < patternCount; i++)
+        bucketStart[pending[i].text[0] - firstBucket + 1]++;
+
+    for (uint8_t i = 1; i <= bucketCount; i++)
+        bucketStart[i] += bucketStart[i-1];
+
+    for (uint8_t i = 0; i < patternCount; i++) {
+        uint8_t bucket = pending[i].text[0] - firstBucket;
+        patterns[bucketStart[bucket] + filled[bucket]++] = pending[i];
+    }
+
+    for (uint8_t b = 0; b < bucketCount; b++) {
+        for (uint8_t i = bucketStart[b] + 1; i < bucketStart[b+1]; i++) {
+            const PATTERN &previous = patterns[i-1];
+            const PATTERN &pattern = patterns[i];
+            uint8_t j = 0;
+            while (j < previous.length && j < pattern.length && previous.text[j] == pattern.text[j])
+                j++;
+            shared[i] = j;
+        }
+    }
+}
+
+// Screens, and any frame the event check turned away
+CrestronMatcher::MESSAGE_TYPE CrestronMatcher::classifyText(const char *message, uint8_t messageLength) {
+    if (messageLength < 2 || message[0] != '"')
+        return MESSAGE_UNKNOWN;
+
+    // Skip the leading '"' so the frame lines up with the pattern texts
+    message++;
+
+    uint8_t bucket = (uint8_t) message[0] - firstBucket;
+    if (bucket >= bucketCount)
+        return MESSAGE_UNKNOWN;
+
+    // Walk the bucket like a trie. matched is how far the message agreed
+    // with the previous pattern, so bytes it shares with this one are never
+    // compared twice. The first byte matches by construction.
+    uint8_t matched = 1;
+
+    for (uint8_t i = bucketStart[bucket]; i < bucketStart[bucket+1]; i++) {
+        const PATTERN &pattern = patterns[i];
+
+        if (i > bucketStart[bucket] && matched != shared[i]) {
+            // Diverged from the last pattern before this one does
+            if (matched < shared[i])
+                continue;
+
+            // Or after, which only matches if this pattern is a prefix of
+            // the last one. Screen texts are configurable so that can happen
+            matched = shared[i];
+            if (matched < pattern.length)
+                continue;
+        }
+
+        while (matched < pattern.length && message[matched] == pattern.text[matched])
+            matched++;
+
+        if (matched == pattern.length &&
+                messageLength >= pattern.minLength &&
+                messageLength <= pattern.maxLength)
+            return pattern.type;
+    }
+
+    return MESSAGE_UNKNOWN;
+}
@@ -0,0 +1,130 @@
+// Copyright 2020 Kevin Cooper
+
+#ifndef __CRESTRONMATCHER_H_
+#define __CRESTRONMATCHER_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define maxScreenLength 32  // Two 16 character lines
+
+// Classifies Crestron frames without a chain of string compares. Patterns
+// are bucketed on the byte after the leading '"', so a frame is only
+// compared against the few patterns that share that byte.
+//
+// Event frames are fixed by the protocol. They are most of the traffic, so
+// are recognised inline from their first bytes and length before any bucket
+// is walked. Screen texts vary by site and language so are supplied at
+// runtime and compiled into the index by begin().
+//
+// Kept free of Particle.h so it can be built and benchmarked on a host.
+
+class CrestronMatcher {
+ public:
+    typedef enum {
+        MESSAGE_UNKNOWN = 0,
+        MESSAGE_ZONE_UPDATE,
+        MESSAGE_ARM_UPDATE,
+        MESSAGE_DISARM_UPDATE,
+        MESSAGE_ENTRY_UPDATE,
+        MESSAGE_ARMING_UPDATE,
+        MESSAGE_INTRUDER_UPDATE,
+        MESSAGE_USER_LOGIN,
+        MESSAGE_REPLY_DISARMED,
+        MESSAGE_REPLY_ARMED,
+        MESSAGE_SCREEN_PART_ARMED,
+        MESSAGE_SCREEN_FULL_ARMED,
+        MESSAGE_SCREEN_IDLE,
+        MESSAGE_WELCOME_BACK,
+        MESSAGE_QUESTION_ARM,
+        MESSAGE_QUESTION_PART_ARM,
+        MESSAGE_QUESTION_NIGHT_ARM,
+        MESSAGE_QUESTION_DISARM,
+        MESSAGE_SCREEN_AREA_ENTRY,
+        MESSAGE_SCREEN_AREA_EXIT,
+        MESSAGE_SCREEN_INVALID_CODE,
+    } MESSAGE_TYPE;
+
+    typedef enum {
+        SCREEN_IDLE = 0,
+        SCREEN_IDLE_PART_ARMED,
+        SCREEN_ARMED_PART,
+        SCREEN_ARMED_NIGHT,
+        SCREEN_ARMED_FULL,
+        SCREEN_WELCOME_BACK,
+        SCREEN_QUESTION_ARM,
+        SCREEN_QUESTION_PART_ARM,
+        SCREEN_QUESTION_NIGHT_ARM,
+        SCREEN_QUESTION_DISARM,
+        SCREEN_AREA_ENTRY,
+        SCREEN_AREA_EXIT,
+        SCREEN_INVALID_CODE,
+        SCREEN_COUNT
+    } SCREEN;
+
+    // Screen texts without the leading '"'. An empty text is never matched
+    struct SCREEN_CONFIG {
+        uint16_t version;
+        char text[SCREEN_COUNT][maxScreenLength+1];
+    };
+
+    // text excludes the leading '"'
+    struct PATTERN {
+        const char *text;
+        uint8_t length;
+        uint8_t minLength;  // Bounds on the whole frame length
+        uint8_t maxLength;
+        MESSAGE_TYPE type;
+    };
+
+    static const uint16_t screenConfigVersion = 2;
+    static const uint8_t firstBucket = ' ';
+    static const uint8_t bucketCount = 96;  // Printable ASCII
+    static const uint8_t maxPatterns = 24;
+
+ public:
+    CrestronMatcher();
+    void begin(const SCREEN_CONFIG *config);
+    static void getDefaultScreens(SCREEN_CONFIG *config);
+    static bool upgradeScreens(SCREEN_CONFIG *config);
+    static int findScreen(const char *name);
+
+    MESSAGE_TYPE classify(const char *message, uint8_t messageLength) {
+        MESSAGE_TYPE type = classifyEvent(message, messageLength);
+        return type != MESSAGE_UNKNOWN ? type : classifyText(message, messageLength);
+    }
+
+ private:
+    // Must agree with the event patterns, which come first in their buckets
+    static MESSAGE_TYPE classifyEvent(const char *message, uint8_t messageLength) {
+        if (messageLength < 5 || message[0] != '"')
+            return MESSAGE_UNKNOWN;
+
+        bool event = messageLength == 6 && message[2] == '0';
+        bool update = messageLength >= 6 && message[2] == '0';
+
+        switch (message[1]) {
+            case 'Z' : return event ? MESSAGE_ZONE_UPDATE : MESSAGE_UNKNOWN;
+            case 'A' : return update ? MESSAGE_ARM_UPDATE : MESSAGE_UNKNOWN;
+            case 'D' : return update ? MESSAGE_DISARM_UPDATE : MESSAGE_UNKNOWN;
+            case 'E' : return event ? MESSAGE_ENTRY_UPDATE : MESSAGE_UNKNOWN;
+            case 'X' : return event ? MESSAGE_ARMING_UPDATE : MESSAGE_UNKNOWN;
+            case 'L' : return event ? MESSAGE_INTRUDER_UPDATE : MESSAGE_UNKNOWN;
+            case 'U' :
+            case 'T' : return event ? MESSAGE_USER_LOGIN : MESSAGE_UNKNOWN;
+            case 'N' : return messageLength == 5 ? MESSAGE_REPLY_DISARMED : MESSAGE_UNKNOWN;
+            case 'Y' : return messageLength == 5 ? MESSAGE_REPLY_ARMED : MESSAGE_UNKNOWN;
+            default : return MESSAGE_UNKNOWN;
+        }
+    }
+
+    MESSAGE_TYPE classifyText(const char *message, uint8_t messageLength);
+
+    PATTERN patterns[maxPatterns];  // Grouped by bucket
+    uint8_t patternCount = 0;
+
+    uint8_t bucketStart[bucketCount + 1];
+    uint8_t shared[maxPatterns];  // Prefix shared with the previous pattern in the bucket
+};
+
+#endif  // __CRESTRONMATCHER_H_
@@ -0,0 +1,119 @@
+#include "digioutputs.h"
+
+DigiOutputs *DigiOutputs::instance = NULL;
+
+DigiOutputs::DigiOutputs() : head(0), tail(0), overflowed(false), levels(0) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+// Each output gets its own handler so the interrupt knows which one fired
+template <uint8_t OUTPUT_INDEX>
+void DigiOutputs::outputChanged() {
+    instance->capture(OUTPUT_INDEX);
+}
+
+// Levels start at initialLevels and any output already away from its
+// initial level is reported by the first read(). The Argon has eight
+// GPIOTE channels, one per output.
+void DigiOutputs::begin(const uint16_t *pins, const bool *initialLevels) {
+    static void (*const handlers[OUTPUT_COUNT])() = {
+        outputChanged<0>, outputChanged<1>, outputChanged<2>, outputChanged<3>,
+        outputChanged<4>, outputChanged<5>, outputChanged<6>, outputChanged<7>
+    };
+
+    instance = this;
+    uint32_t now = micros();
+    uint8_t initial = 0;
+
+    for (uint8_t i = 0; i < OUTPUT_COUNT; i++)
+        initial |= initialLevels[i] << i;
+    levels.store(initial);
+
+    for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+        this->pins[i] = pins[i];
+        debounce[i] = defaultDebounce;
+
+        pinMode(pins[i], INPUT);
+        pending[i] = pinReadFast(pins[i]);
+        pendingMicros[i] = now - defaultDebounce;
+        attachInterrupt(pins[i], handlers[i], CHANGE);
+    }
+}
+
+void DigiOutputs::capture(uint8_t output) {
+    uint32_t now = micros();
+    uint8_t at = head.load(std::memory_order_relaxed);
+    uint8_t next = (at + 1) % digiEventQueueSize;
+
+    if (next == tail.load(std::memory_order_acquire)) {
+        overflowed.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    queue[at].output = output;
+    queue[at].level = pinReadFast(pins[output]);
+    queue[at].micros = now;
+    head.store(next, std::memory_order_release);
+}
+
+// Returns the next debounced change. An edge only counts once its level
+// has held for the output's debounce time, so a pulse shorter than that is
+// dropped, while any longer pulse is reported even if it ended before
+// read() was called.
+bool DigiOutputs::read(OUTPUT_EVENT *event) {
+    uint8_t at = tail.load(std::memory_order_relaxed);
+
+    while (at != head.load(std::memory_order_acquire)) {
+        const OUTPUT_EVENT &edge = queue[at];
+        uint8_t output = edge.output;
+
+        if (edge.level != pending[output]) {
+            // The level before this edge lasted long enough to report
+            if (!isStable(output, pending[output]) &&
+                    edge.micros - pendingMicros[output] >= debounce[output])
+                return commit(output, event);
+
+            if (!isStable(output, pending[output]))
+                stats.bounces++;
+
+            pending[output] = edge.level;
+            pendingMicros[output] = edge.micros;
+            stats.edges++;
+        }
+
+        at = (at + 1) % digiEventQueueSize;
+        tail.store(at, std::memory_order_release);
+    }
+
+    // Edges were lost, so take the pins as they are now
+    if (overflowed.exchange(false)) {
+        stats.overflows++;
+        uint32_t now = micros();
+        for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+            bool level = pinReadFast(pins[i]);
+            if (level != pending[i]) {
+                pending[i] = level;
+                pendingMicros[i] = now;
+            }
+        }
+    }
+
+    uint32_t now = micros();
+    for (uint8_t i = 0; i < OUTPUT_COUNT; i++) {
+        if (!isStable(i, pending[i]) && now - pendingMicros[i] >= debounce[i])
+            return commit(i, event);
+    }
+
+    return false;
+}
+
+bool DigiOutputs::commit(uint8_t output, OUTPUT_EVENT *event) {
+    if (pending[output])
+        levels.fetch_or(1 << output);
+    else
+        levels.fetch_and(~(1 << output));
+    event->output = output;
+    event->level = pending[output];
+    event->micros = pendingMicros[output];
+    return true;
+}
@@ -0,0 +1,75 @@
+// Copyright 2020 Kevin Cooper
+
+#ifndef __DIGIOUTPUTS_H_
+#define __DIGIOUTPUTS_H_
+
+#include <atomic>
+
+#include "Particle.h"
+
+#define digiEventQueueSize 32 // Power of two
+
+// Captures every edge on the panel's digi outputs from pin interrupts,
+// timestamped when it happens rather than when loop() next gets to it.
+// Edges are debounced per output as they are read back.
+class DigiOutputs {
+ public:
+    typedef enum {  // Digi output 1 to 8
+        OUTPUT_FULL_ARMED = 0,
+        OUTPUT_PART_ARMED = 1,
+        OUTPUT_EXIT = 2,
+        OUTPUT_ENTRY = 3,
+        OUTPUT_TRIGGERED = 4,
+        OUTPUT_ARM_FAILED = 5,
+        OUTPUT_FAULT_PRESENT = 6,
+        OUTPUT_AREA_READY = 7,
+        OUTPUT_COUNT
+    } OUTPUT;
+
+    struct OUTPUT_EVENT {
+        uint8_t output;
+        bool level;
+        uint32_t micros;    // When the edge happened
+    };
+
+    struct DIGI_STATS {
+        uint32_t edges;     // Captured by the interrupts
+        uint32_t bounces;   // Edges that did not last the debounce time
+        uint32_t overflows; // Times the queue filled and the pins were polled
+    };
+
+ public:
+    DigiOutputs();
+    void begin(const uint16_t *pins, const bool *initialLevels);
+    bool read(OUTPUT_EVENT *event);
+    bool getLevel(OUTPUT output) { return (levels.load() >> output) & 1; }
+    uint8_t getLevels() { return levels.load(); }
+    void setDebounce(OUTPUT output, uint32_t debounce) { this->debounce[output] = debounce; }
+    const DIGI_STATS& getStats() { return stats; }
+
+ private:
+    template <uint8_t OUTPUT_INDEX> static void outputChanged();
+    void capture(uint8_t output);
+    bool commit(uint8_t output, OUTPUT_EVENT *event);
+    bool isStable(uint8_t output, bool level) { return ((levels.load() >> output) & 1) == level; }
+    static DigiOutputs *instance;
+
+    uint16_t pins[OUTPUT_COUNT];
+
+    // Single producer, the GPIOTE interrupt, and single consumer, read()
+    OUTPUT_EVENT queue[digiEventQueueSize];
+    std::atomic<uint8_t> head;
+    std::atomic<uint8_t> tail;
+    std::atomic<bool> overflowed;
+
+    // Last level reported for each output, bit n for output n, so other
+    // threads read every output from one snapshot
+    std::atomic<uint8_t> levels;
+    bool pending[OUTPUT_COUNT];         // Latest level captured
+    uint32_t pendingMicros[OUTPUT_COUNT];
+    uint32_t debounce[OUTPUT_COUNT];    // microseconds
+    const uint32_t defaultDebounce = 1000;
+    DIGI_STATS stats;
+};
+
+#endif  // __DIGIOUTPUTS_H_
@@ -0,0 +1,86 @@
+#include "jobqueue.h"
+
+JobQueue::JobQueue() {
+    memset(jobs, 0, sizeof(jobs));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void JobQueue::setExpiredCallback(void (*expiredCallback)(JOB_TYPE)) {
+    this->expiredCallback = expiredCallback;
+}
+
+// Returns the job so the caller can fill in its details. A request for a
+// type that is already pending keeps its place and takes the later deadline
+JobQueue::JOB* JobQueue::add(JOB_TYPE type, uint32_t timeout, uint32_t now) {
+    JOB *job = &jobs[type];
+
+    if (job->pending) {
+        stats.coalesced++;
+    } else {
+        memset(job, 0, sizeof(JOB));
+        job->pending = true;
+        job->queuedTime = now;
+        stats.queued++;
+    }
+
+    job->deadline = now + timeout;
+    return job;
+}
+
+void JobQueue::cancel(JOB_TYPE type) {
+    if (jobs[type].pending)
+        memset(&jobs[type], 0, sizeof(JOB));
+}
+
+// Drops a job past its deadline and reports it, as the request it came
+// from was accepted but will never run
+bool JobQueue::expireJob(JOB_TYPE type, uint32_t now) {
+    if (!jobs[type].pending || (int32_t) (now - jobs[type].deadline) <= 0)
+        return false;
+
+    stats.expired++;
+    cancel(type);
+    if (expiredCallback)
+        expiredCallback(type);
+    return true;
+}
+
+// Called every loop so a job is reported at its deadline, not when the
+// panel is next free
+void JobQueue::expire(uint32_t now) {
+    for (uint8_t i = 0; i < JOB_TYPE_COUNT; i++)
+        expireJob((JOB_TYPE) i, now);
+}
+
+// Takes the highest priority pending job, dropping any past their deadline
+bool JobQueue::next(JOB_TYPE *type, JOB *job, uint32_t now) {
+    for (uint8_t i = 0; i < JOB_TYPE_COUNT; i++) {
+        if (!jobs[i].pending || expireJob((JOB_TYPE) i, now))
+            continue;
+
+        *type = (JOB_TYPE) i;
+        *job = jobs[i];
+        cancel((JOB_TYPE) i);
+        return true;
+    }
+
+    return false;
+}
+
+// Takes a job of the given type, if one is pending and still in time, so
+// it can run alongside the job that is starting
+bool JobQueue::take(JOB_TYPE type, uint32_t now) {
+    if (!jobs[type].pending || expireJob(type, now))
+        return false;
+
+    cancel(type);
+    return true;
+}
+
+bool JobQueue::isEmpty() {
+    for (uint8_t i = 0; i < JOB_TYPE_COUNT; i++) {
+        if (jobs[i].pending)
+            return false;
+    }
+    return true;
+}
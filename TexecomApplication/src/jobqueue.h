@@ -0,0 +1,57 @@
+// Copyright 2020 Kevin Cooper
+
+#ifndef __JOBQUEUE_H_
+#define __JOBQUEUE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// Kept free of Particle.h so it can be built and tested on a host, so the
+// caller passes in the time
+
+class JobQueue {
+ public:
+    typedef enum {  // Highest priority first
+        JOB_DISARM = 0,
+        JOB_ARM = 1,
+        JOB_ZONE_SYNC = 2,
+        JOB_TIME_SYNC = 3,
+        JOB_TYPE_COUNT
+    } JOB_TYPE;
+
+    struct JOB {
+        bool pending;
+        uint32_t queuedTime;    // First request coalesced into the job
+        uint32_t deadline;      // Dropped if not started by then
+        char pin[9];
+        uint8_t armType;
+    };
+
+    struct JOB_STATS {
+        uint32_t queued;
+        uint32_t coalesced;     // Requests merged into a pending job
+        uint32_t expired;       // Jobs dropped at their deadline
+    };
+
+ public:
+    JobQueue();
+    void setExpiredCallback(void (*expiredCallback)(JOB_TYPE));
+    JOB* add(JOB_TYPE type, uint32_t timeout, uint32_t now);
+    void cancel(JOB_TYPE type);
+    void expire(uint32_t now);
+    bool next(JOB_TYPE *type, JOB *job, uint32_t now);
+    bool take(JOB_TYPE type, uint32_t now);
+    bool isPending(JOB_TYPE type) { return jobs[type].pending; }
+    bool isEmpty();
+    const JOB_STATS& getStats() { return stats; }
+
+ private:
+    // One slot per type, so a repeated request merges into the pending job
+    // and priority is just the order the slots are checked in
+    JOB jobs[JOB_TYPE_COUNT];
+    JOB_STATS stats;
+    void (*expiredCallback)(JOB_TYPE) = NULL;
+    bool expireJob(JOB_TYPE type, uint32_t now);
+};
+
+#endif  // __JOBQUEUE_H_
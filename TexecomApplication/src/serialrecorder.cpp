@@ -0,0 +1,140 @@
+// Copyright 2020 Kevin Cooper
+
+#include "serialrecorder.h"
+#if HAL_PLATFORM_FILESYSTEM
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+SerialRecorder::SerialRecorder() {}
+
+void SerialRecorder::record(DIRECTION direction, PROTOCOL protocol, const char *data, uint8_t length) {
+    record(direction, protocol, data, length, micros());
+}
+
+void SerialRecorder::record(DIRECTION direction, PROTOCOL protocol, const char *data, uint8_t length, uint32_t timestamp) {
+    if (!isEnabled)
+        return;
+
+    RECORD_HEADER header;
+    header.micros = timestamp;
+    header.flags = direction | protocol;
+    header.length = length;
+
+    uint16_t recordSize = sizeof(RECORD_HEADER) + length;
+
+    // Drop the oldest records to make room
+    while (headPosition + recordSize - tailPosition > recorderBufferSize) {
+        RECORD_HEADER oldest;
+        copyOut(tailPosition, (uint8_t *) &oldest, sizeof(RECORD_HEADER));
+        tailPosition += sizeof(RECORD_HEADER) + oldest.length;
+        if (spillToFlash && spillPosition < tailPosition) {
+            spillPosition = tailPosition;
+            droppedRecords++;
+        }
+    }
+
+    const uint8_t *source = (const uint8_t *) &header;
+    for (uint8_t i = 0; i < sizeof(RECORD_HEADER); i++)
+        ring[(headPosition++) % recorderBufferSize] = source[i];
+
+    for (uint8_t i = 0; i < length; i++)
+        ring[(headPosition++) % recorderBufferSize] = data[i];
+}
+
+void SerialRecorder::copyOut(uint32_t position, uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++)
+        data[i] = ring[(position + i) % recorderBufferSize];
+}
+
+uint8_t SerialRecorder::getFileHeader(uint8_t *header) {
+    memcpy(header, "TXCP", 4);
+    header[4] = captureVersion;
+    memcpy(&header[5], &baudRate, sizeof(baudRate));
+    return fileHeaderSize;
+}
+
+uint16_t SerialRecorder::read(uint32_t *position, uint8_t *data, uint16_t maxLength) {
+    // Records older than the tail have been overwritten
+    if (*position < tailPosition)
+        *position = tailPosition;
+
+    // Copy whole records only
+    uint16_t length = 0;
+    while (*position < headPosition) {
+        RECORD_HEADER header;
+        copyOut(*position, (uint8_t *) &header, sizeof(RECORD_HEADER));
+        uint16_t recordSize = sizeof(RECORD_HEADER) + header.length;
+
+        if (length + recordSize > maxLength)
+            break;
+
+        copyOut(*position, &data[length], recordSize);
+        length += recordSize;
+        *position += recordSize;
+    }
+    return length;
+}
+
+void SerialRecorder::setSpillToFlash(bool enabled) {
+#if HAL_PLATFORM_FILESYSTEM
+    if (enabled && spillFile < 0) {
+        spillFile = open(recorderSpillFile, O_WRONLY | O_CREAT | O_TRUNC);
+        if (spillFile < 0) {
+            Log.error("RECORDER: Unable to open %s", recorderSpillFile);
+            return;
+        }
+
+        uint8_t header[fileHeaderSize];
+        uint8_t headerSize = getFileHeader(header);
+        if (write(spillFile, header, headerSize) != headerSize) {
+            Log.error("RECORDER: Unable to write %s", recorderSpillFile);
+            close(spillFile);
+            spillFile = -1;
+            spillToFlash = false;
+            return;
+        }
+
+        spilledBytes = headerSize;
+        spillPosition = tailPosition;
+        Log.info("RECORDER: Spilling capture to %s", recorderSpillFile);
+    } else if (!enabled && spillFile >= 0) {
+        close(spillFile);
+        spillFile = -1;
+    }
+    spillToFlash = enabled && spillFile >= 0;
+#else
+    Log.error("RECORDER: No filesystem to spill to");
+#endif
+}
+
+void SerialRecorder::spill() {
+#if HAL_PLATFORM_FILESYSTEM
+    uint8_t data[256];
+
+    uint16_t length = read(&spillPosition, data, sizeof(data));
+    if (length == 0)
+        return;
+
+    if (write(spillFile, data, length) != length) {
+        Log.error("RECORDER: Unable to write %s", recorderSpillFile);
+        setSpillToFlash(false);
+        return;
+    }
+    spilledBytes += length;
+
+    if (spilledBytes >= recorderMaxSpillSize) {
+        Log.info("RECORDER: Capture file full");
+        setSpillToFlash(false);
+    }
+#endif
+}
+
+void SerialRecorder::loop() {
+    // Flash writes are slow so only spill a little each pass
+    if (spillToFlash)
+        spill();
+}
+
+// make one instance for the user to use
+SerialRecorder Recorder = SerialRecorder();
@@ -0,0 +1,73 @@
+// Copyright 2020 Kevin Cooper
+
+#ifndef __SERIALRECORDER_H_
+#define __SERIALRECORDER_H_
+
+#include "Particle.h"
+
+#define recorderBufferSize 4096
+#define recorderSpillFile "/capture.bin"
+#define recorderMaxSpillSize 65536
+
+// Capture format
+//
+// File header: "TXCP", uint8_t version, uint32_t baud rate
+// Record:      uint32_t micros, uint8_t flags, uint8_t length, uint8_t data[length]
+//
+// All values are little endian. flags holds the DIRECTION and PROTOCOL bits.
+
+class SerialRecorder {
+ public:
+    typedef enum {
+        RECORD_RX = 0,
+        RECORD_TX = 1 << 0,
+    } DIRECTION;
+
+    typedef enum {
+        RECORD_CRESTRON = 0,
+        RECORD_SIMPLE = 1 << 1,
+    } PROTOCOL;
+
+    struct RECORD_HEADER {
+        uint32_t micros;
+        uint8_t flags;
+        uint8_t length;
+    } __attribute__((packed));
+
+    static const uint8_t fileHeaderSize = 9;
+    static const uint8_t captureVersion = 1;
+
+ public:
+    SerialRecorder();
+    void begin(uint32_t baudRate) { this->baudRate = baudRate; }
+    void loop();
+    void record(DIRECTION direction, PROTOCOL protocol, const char *data, uint8_t length, uint32_t timestamp);
+    void record(DIRECTION direction, PROTOCOL protocol, const char *data, uint8_t length);
+    void setEnabled(bool enabled) { isEnabled = enabled; }
+    void setSpillToFlash(bool enabled);
+    uint8_t getFileHeader(uint8_t *header);
+    uint32_t oldestRecord() { return tailPosition; }
+    uint16_t read(uint32_t *position, uint8_t *data, uint16_t maxLength);
+    uint32_t getDroppedRecords() { return droppedRecords; }
+
+ private:
+    void copyOut(uint32_t position, uint8_t *data, uint16_t length);
+    void spill();
+
+    // Positions only ever increase and are wrapped on access, so a reader
+    // can tell when the records it wanted have been overwritten
+    uint8_t ring[recorderBufferSize];
+    uint32_t headPosition = 0;
+    uint32_t tailPosition = 0;
+    uint32_t spillPosition = 0;
+    uint32_t spilledBytes = 0;
+    uint32_t droppedRecords = 0;
+    uint32_t baudRate = 0;
+    bool isEnabled = true;
+    bool spillToFlash = false;
+    int spillFile = -1;
+};
+
+extern SerialRecorder Recorder;
+
+#endif  // __SERIALRECORDER_H_
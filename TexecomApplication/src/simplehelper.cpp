@@ -1,26 +1,48 @@
 #include "simplehelper.h"
+#include "serialrecorder.h"
 
 SimpleHelper::SimpleHelper() {}
 
-bool SimpleHelper::checkSimpleChecksum(const char *text, uint8_t length) {
-    unsigned int a = 0;
-    for (unsigned int i = 0; i < length; i++) {
-        a += text[i];
-    }
-    char checksum = (a ^ 255) % 0x100;
-    return checksum == text[length];
+// sum is the running total of the payload bytes, kept as they arrive
+bool SimpleHelper::checkSimpleChecksum(uint16_t sum, char received) {
+    return checksum(sum) == received;
+}
+
+// Binary payloads can contain CRLF, so a reply can only end where the
+// command sent expects it to. Any command may be answered "OK" or "ERROR".
+bool SimpleHelper::isReplyLength(uint8_t length) {
+    return expectedReplyLength == 0 || length == expectedReplyLength ||
+            length == 2 || length == 5;
 }
 
 void SimpleHelper::sendSimpleMessage(const char *text, uint8_t length) {
-    unsigned int a = 0;
+    uint16_t a = 0;
     for (unsigned int i = 0; i < length; i++) {
-        a += text[i];
+        a += (uint8_t) text[i];
         texSerial.write(text[i]);
         // Log.info("Message: %d", text[i]);
     }
-    char checksum = (a ^ 255) % 0x100;
+    char checksum = this->checksum(a);
     texSerial.write(checksum);
     // Log.info("Message: %d", checksum);
+
+    char sent[length + 1];
+    memcpy(sent, text, length);
+    sent[length] = checksum;
+
+    // The login carries the UDL code, and its checksum is derived from it
+    if (length > 3 && text[1] == 'W') {
+        memset(&sent[2], '*', length - 3);
+        sent[length] = '*';
+    }
+    Recorder.record(SerialRecorder::RECORD_TX, SerialRecorder::RECORD_SIMPLE, sent, length + 1);
+
+    if (length >= 4 && text[1] == 'Z')        // Two bytes per zone
+        expectedReplyLength = (uint8_t) text[3] * 2;
+    else if (length >= 3 && text[1] == 'T' && text[2] == '?')
+        expectedReplyLength = 5;            // Day, month, year, hour, minute
+    else
+        expectedReplyLength = 2;            // "OK"
 }
 
 bool SimpleHelper::processReceivedTime(const char *message) {
@@ -44,42 +66,6 @@ bool SimpleHelper::processReceivedTime(const char *message) {
     }
 }
 
-bool SimpleHelper::processReceivedZoneData(const char *message, uint8_t messageLength, uint8_t *zoneState) {
-
-    for (uint8_t i = 0; i < messageLength; i+=2) {
-        uint8_t lowByte = message[i];
-        // uint8_t HighByte = message[i+1];
-
-        zoneState[i/2] = lowByte;
-
-        /*
-        bool a1 = (lowByte & 0x1) != 0;
-        bool a2 = (lowByte & 0x2) != 0;
-        bool a3 = (lowByte & 0x4) != 0;
-        bool a4 = (lowByte & 0x8) != 0;
-        bool a5 = (lowByte & 0x10) != 0;
-        bool a6 = (lowByte & 0x20) != 0;
-        bool a7 = (lowByte & 0x40) != 0;
-        bool a8 = (lowByte & 0x80) != 0;
-
-        bool b1 = (HighByte & 0x1) != 0;
-        bool b2 = (HighByte & 0x2) != 0;
-        bool b3 = (HighByte & 0x4) != 0;
-        bool b4 = (HighByte & 0x8) != 0;
-        bool b5 = (HighByte & 0x10) != 0;
-        bool b6 = (HighByte & 0x20) != 0;
-        bool b7 = (HighByte & 0x40) != 0;
-        bool b8 = (HighByte & 0x80) != 0;
-
-        Log.info("Zone %d L - %d %d %d %d %d %d %d %d", (i/2)+9, a1, a2, a3, a4, a5, a6, a7, a8);
-        Log.info("Zone %d H - %d %d %d %d %d %d %d %d", (i/2)+9, b1, b2, b3, b4, b5, b6, b7, b8);
-        */
-
-
-    }
-    return true;
-}
-
 void SimpleHelper::simpleLogout() {
     
 }
\ No newline at end of file
@@ -18,12 +18,15 @@ class SimpleHelper {
 
  public:
     SimpleHelper();
-    bool checkSimpleChecksum(const char *text, uint8_t length);
+    static char checksum(uint16_t sum) { return (sum ^ 255) % 0x100; }
+    bool checkSimpleChecksum(uint16_t sum, char received);
+    bool isReplyLength(uint8_t length);
     void sendSimpleMessage(const char *text, uint8_t length);
     bool processReceivedTime(const char *message);
-    bool processReceivedZoneData(const char *message, uint8_t messageLength, uint8_t *zoneState);
     void simpleLogout();
  private:
+    // Payload length of the reply to the last command sent, 0 if unknown
+    uint8_t expectedReplyLength = 0;
 };
 
  #endif  //__SIMPLEHELPER_H_
\ No newline at end of file
@@ -2,10 +2,69 @@
 
 #include "texecom.h"
 #include "TimeAlarms.h"
+#include "serialrecorder.h"
 
 TexecomClass::TexecomClass() {}
 
-void TexecomClass::setZoneCallback(void (*zoneCallback)(uint8_t, uint8_t)) {
+// The state and flags shown by each combination of active (low) digi
+// outputs, indexed by active outputs as bit n for DigiOutputs output n.
+// Where several state outputs are active the latest stage of the arm and
+// alarm sequence wins, so an armed output outranks an exit output that is
+// still clearing.
+struct DIGI_STATE_TABLE {
+    struct {
+        uint8_t state;  // ALARM_STATE, or noDigiState if none are active
+        uint8_t flags;  // ALARM_FLAGS
+    } entry[256];
+
+    constexpr DIGI_STATE_TABLE() : entry() {
+        for (int active = 0; active < 256; active++) {
+            uint8_t state = noDigiState;
+
+            if (active & (1 << DigiOutputs::OUTPUT_TRIGGERED))
+                state = TexecomClass::TRIGGERED;
+            else if (active & (1 << DigiOutputs::OUTPUT_ENTRY))
+                state = TexecomClass::ENTRY;
+            else if (active & (1 << DigiOutputs::OUTPUT_FULL_ARMED))
+                state = TexecomClass::ARMED_AWAY;
+            else if (active & (1 << DigiOutputs::OUTPUT_PART_ARMED))
+                state = TexecomClass::ARMED_HOME;
+            else if (active & (1 << DigiOutputs::OUTPUT_EXIT))
+                state = TexecomClass::EXIT;
+
+            entry[active].state = state;
+            entry[active].flags =
+                (active & (1 << DigiOutputs::OUTPUT_AREA_READY) ? TexecomClass::ALARM_READY : 0) |
+                (active & (1 << DigiOutputs::OUTPUT_FAULT_PRESENT) ? TexecomClass::ALARM_FAULT : 0) |
+                (active & (1 << DigiOutputs::OUTPUT_ARM_FAILED) ? TexecomClass::ALARM_ARM_FAILED : 0);
+        }
+    }
+};
+
+static constexpr DIGI_STATE_TABLE digiStates;
+
+#if (SYSTEM_VERSION >= SYSTEM_VERSION_DEFAULT(3, 3, 0))
+// Serial1's RX ring is filled from the UART interrupt. The default 64 bytes
+// only holds a couple of frames, so enlarge it to absorb bursts of zone
+// updates between passes of loop().
+hal_usart_buffer_config_t acquireSerial1Buffer() {
+    hal_usart_buffer_config_t config = {
+        .size = sizeof(hal_usart_buffer_config_t),
+        .rx_buffer = new (std::nothrow) uint8_t[texSerialRxBufferSize],
+        .rx_buffer_size = texSerialRxBufferSize,
+        .tx_buffer = new (std::nothrow) uint8_t[texSerialTxBufferSize],
+        .tx_buffer_size = texSerialTxBufferSize
+    };
+
+    return config;
+}
+#endif
+
+void TexecomClass::setTriggerCallback(void (*triggerCallback)(uint16_t, TexecomClass::TRIGGER_SOURCE)) {
+    this->triggerCallback = triggerCallback;
+}
+
+void TexecomClass::setZoneCallback(void (*zoneCallback)(uint16_t, uint8_t)) {
     this->zoneCallback = zoneCallback;
 }
 
@@ -13,6 +72,10 @@ void TexecomClass::setAlarmCallback(void (*alarmCallback)(TexecomClass::ALARM_ST
     this->alarmCallback = alarmCallback;
 }
 
+void TexecomClass::setFailureCallback(void (*failureCallback)(TexecomClass::CRESTRON_TASK, const char *)) {
+    this->failureCallback = failureCallback;
+}
+
 void TexecomClass::setDebug(bool enabled) {
     savedData.isDebug = enabled;
     EEPROM.put(0, savedData);
@@ -26,42 +89,228 @@ void TexecomClass::setUDLCode(const char *code) {
     Log.info("New UDL code = %s", savedData.udlCode);
 }
 
-void TexecomClass::requestTimeSync() { Alarm.timerOnce(1, startTimeSync); }
+bool TexecomClass::setScreenText(const char *name, const char *text) {
+    int screen = CrestronMatcher::findScreen(name);
+
+    if (screen < 0 || strlen(text) > maxScreenLength)
+        return false;
+
+    strcpy(screenConfig.text[screen], text);
+    EEPROM.put(screenConfigAddress, screenConfig);
+    crestronMatcher.begin(&screenConfig);
+    Log.info("Screen %s = \"%s\"", name, text);
+    return true;
+}
+
+// "9-19,33-40" replaces the configured zone ranges
+bool TexecomClass::setZoneRanges(const char *ranges) {
+    ZoneMap::ZONE_CONFIG config;
+
+    // A zone read in progress indexes the current zone state
+    if (simpleTask != SIMPLE_IDLE || !ZoneMap::parseConfig(ranges, &config))
+        return false;
+
+    zoneConfig = config;
+    EEPROM.put(zoneConfigAddress, zoneConfig);
+    configureZones();
+    Log.info("Zones = %s", ranges);
+    return true;
+}
+
+// Sizes per-zone state to the configured zones, every one of which is
+// then read and published by the next sync
+void TexecomClass::configureZones() {
+    delete[] suspectZones;
+    delete[] publishedZones;
+
+    zoneMap.begin(&zoneConfig);
+    zoneStore.begin(zoneMap.count());
+    uint16_t words = zoneMap.zoneWords();
+
+    suspectZones = new uint32_t[words];
+    publishedZones = new uint32_t[words]();
+    zoneMap.fill(suspectZones);
+    requestZoneSync();
+}
+
+bool TexecomClass::setOutputDebounce(uint8_t output, uint32_t debounce) {
+    if (output >= DigiOutputs::OUTPUT_COUNT)
+        return false;
+
+    digiOutputs.setDebounce((DigiOutputs::OUTPUT) output, debounce);
+    Log.info("Digi output %d debounce = %luus", output + 1, debounce);
+    return true;
+}
+
+void TexecomClass::resetScreenTexts() {
+    CrestronMatcher::getDefaultScreens(&screenConfig);
+    EEPROM.put(screenConfigAddress, screenConfig);
+    crestronMatcher.begin(&screenConfig);
+    Log.info("Screen texts reset to defaults");
+}
+
+void TexecomClass::setFrameGapTimeout(uint32_t timeout) {
+    frameGapTimeoutOverride = timeout * 1000;
+    Log.info("Frame gap timeout = %lums (0 = adaptive)", timeout);
+}
+
+void TexecomClass::setFastPath(bool enabled) {
+    fastPath = enabled;
+    Log.info("Fast path %s", enabled ? "enabled" : "disabled");
+}
 
-void TexecomClass::startTimeSync() { Texecom.syncTime(); }
+void TexecomClass::setCacheMaxAge(uint32_t maxAge) {
+    cacheMaxAge = maxAge;
+    Log.info("Cache max age = %lums (0 = disabled)", maxAge);
+}
+
+void TexecomClass::requestTimeSync() {
+    if (rejectWithoutLink(CRESTRON_IDLE))
+        return;
+    jobQueue.add(JobQueue::JOB_TIME_SYNC, timeSyncJobTimeout, millis());
+}
+
+// Called by TimeAlarms, which only queues the job
+void TexecomClass::startTimeSync() {
+    Texecom.requestTimeSync();
+    Alarm.completeTriggeredAlarm();
+}
 
 void TexecomClass::syncTime() {
-    simpleTask = SIMPLE_CHECK_TIME;
-    taskStep = SIMPLE_LOGIN_REQUIRED;
-    simpleLogin(RESULT_NONE);
+    startSimpleSession(SIMPLE_OP_TIME);
 }
 
-void TexecomClass::requestZoneSync() { Alarm.timerOnce(1, startZoneSync); }
+// A full sync reads and republishes every zone, otherwise only suspect
+// zones are read
+void TexecomClass::requestZoneSync(bool fullSync) {
+    if (fullSync && suspectZones) {
+        zoneMap.fill(suspectZones);
+        memset(publishedZones, 0, zoneMap.zoneWords() * sizeof(uint32_t));
+    }
 
-void TexecomClass::startZoneSync() { Texecom.syncZones(); }
+    // Anything suspect stays so until the link is back
+    if (rejectWithoutLink(CRESTRON_IDLE))
+        return;
+
+    jobQueue.add(JobQueue::JOB_ZONE_SYNC, zoneSyncJobTimeout, millis());
+}
+
+void TexecomClass::startZoneSync() {
+    Texecom.requestZoneSync();
+    Alarm.completeTriggeredAlarm();
+}
 
 void TexecomClass::syncZones() {
-    simpleTask = SIMPLE_ZONE_CHECK;
+    startSimpleSession(SIMPLE_OP_ZONES);
+}
+
+// Each Simple login takes the panel out of Crestron mode, so every
+// operation that is due runs in one session between login and logout
+void TexecomClass::startSimpleSession(uint8_t operations) {
+    operations |= takeSimpleJobs();
+
+    if ((operations & SIMPLE_OP_ZONES) && !hasSuspectZones()) {
+        Log.info("ZONE: No suspect zones, skipping zone read");
+        operations &= ~SIMPLE_OP_ZONES;
+    }
+
+    if (operations == 0)
+        return;
+
+    simpleOperations = operations;
+    simpleTask = SIMPLE_SESSION;
     taskStep = SIMPLE_LOGIN_REQUIRED;
+    taskStats.simpleSessions++;
     simpleLogin(RESULT_NONE);
 }
 
-void TexecomClass::requestDisarm(const char *code) {
-    if (strlen(userPin) > 0) {
-        Log.info("DISARM: Request already in progress");
-        return;
+// Pull queued Simple work into the running session, unless an arm or
+// disarm is waiting for the panel
+uint8_t TexecomClass::takeSimpleJobs() {
+    uint8_t operations = 0;
+
+    if (jobQueue.isPending(JobQueue::JOB_DISARM) || jobQueue.isPending(JobQueue::JOB_ARM))
+        return operations;
+
+    if (jobQueue.take(JobQueue::JOB_ZONE_SYNC, millis()))
+        operations |= SIMPLE_OP_ZONES;
+    if (jobQueue.take(JobQueue::JOB_TIME_SYNC, millis()))
+        operations |= SIMPLE_OP_TIME;
+
+    return operations;
+}
+
+void TexecomClass::nextSimpleOperation() {
+    simpleOperations |= takeSimpleJobs();
+    taskStep = SIMPLE_START;
+
+    if ((simpleOperations & SIMPLE_OP_ZONES) && !hasSuspectZones())
+        simpleOperations &= ~SIMPLE_OP_ZONES;
+
+    if (simpleOperations & SIMPLE_OP_ZONES) {
+        simpleOperations &= ~SIMPLE_OP_ZONES;
+        simpleTask = SIMPLE_ZONE_CHECK;
+        taskStats.simpleOperations++;
+        zoneCheck(RESULT_NONE);
+    } else if (simpleOperations & SIMPLE_OP_TIME) {
+        simpleOperations &= ~SIMPLE_OP_TIME;
+        simpleTask = SIMPLE_CHECK_TIME;
+        taskStats.simpleOperations++;
+        checkTime(RESULT_NONE);
+    } else {
+        Log.info("SIMPLE: Session complete, logging out");
+        simpleTask = SIMPLE_SESSION;
+        simpleHelper.sendSimpleMessage("\\H/", 3);
+        taskStep = SIMPLE_LOGOUT;
     }
+}
 
-    if (strlen(code) <= 8)
-        snprintf(userPin, sizeof(userPin), code);
+void TexecomClass::endSimpleSession(TASK_STEP_RESULT result) {
+    if (result == SIMPLE_OK)
+        Log.info("SIMPLE: Logout confirmed");
     else
-        return;
+        Log.info("SIMPLE: Uh oh logout - %d", result);
 
-    Alarm.timerOnce(1, startDisarm);
+    activeProtocol = CRESTRON;
+    simpleTask = SIMPLE_IDLE;
+    simpleOperations = 0;
 }
 
-void TexecomClass::startDisarm() {
-    Texecom.disarm();
+// The heartbeat is held off during a Simple session, so a login that is
+// never answered is the only sign of a dead link. If the panel sent nothing
+// at all it is taken as down, otherwise the UDL code was refused
+void TexecomClass::abandonSimpleLogin() {
+    Log.error("SIMPLE: No login after %d attempts", simpleLoginAttempts);
+
+    activeProtocol = CRESTRON;
+    simpleTask = SIMPLE_IDLE;
+    simpleOperations = 0;
+    taskStep = SIMPLE_START;
+
+    if (serialStats.frameCount == simpleLoginFrameCount)
+        setLinkDown();
+}
+
+// Panel operations are refused straight away while the link is down
+// rather than left to time out
+bool TexecomClass::rejectWithoutLink(CRESTRON_TASK task) {
+    if (isLinkUp())
+        return false;
+
+    Log.info("Request rejected, serial link down");
+    if (failureCallback && task != CRESTRON_IDLE)
+        failureCallback(task, "Serial link down");
+    return true;
+}
+
+// The latest arm or disarm request wins over one still waiting to run
+void TexecomClass::requestDisarm(const char *code) {
+    if (strlen(code) > 8 || rejectWithoutLink(CRESTRON_DISARM))
+        return;
+
+    jobQueue.cancel(JobQueue::JOB_ARM);
+    JobQueue::JOB *job = jobQueue.add(JobQueue::JOB_DISARM, disarmJobTimeout, millis());
+    snprintf(job->pin, sizeof(job->pin), code);
 }
 
 void TexecomClass::disarm() {
@@ -71,22 +320,62 @@ void TexecomClass::disarm() {
 }
 
 void TexecomClass::requestArm(const char *code, ARM_TYPE type) {
-    if (strlen(userPin) > 0) {
-        Log.info("ARM: Request already in progress");
+    if (strlen(code) > 8 || rejectWithoutLink(CRESTRON_ARM))
         return;
-    }
 
-    if (strlen(code) <= 8)
-        snprintf(userPin, sizeof(userPin), code);
-    else
+    jobQueue.cancel(JobQueue::JOB_DISARM);
+    JobQueue::JOB *job = jobQueue.add(JobQueue::JOB_ARM, armJobTimeout, millis());
+    snprintf(job->pin, sizeof(job->pin), code);
+    job->armType = type;
+}
+
+// An accepted arm or disarm that never ran must still be reported
+void TexecomClass::jobExpired(JobQueue::JOB_TYPE type) {
+    Log.info("JOB: Job %d expired before it could run", type);
+
+    if (!Texecom.failureCallback)
         return;
 
-    armType = type;
-    Alarm.timerOnce(1, startArm);
+    if (type == JobQueue::JOB_ARM)
+        Texecom.failureCallback(CRESTRON_ARM, "Deadline expired");
+    else if (type == JobQueue::JOB_DISARM)
+        Texecom.failureCallback(CRESTRON_DISARM, "Deadline expired");
 }
 
-void TexecomClass::startArm() {
-    Texecom.arm();
+// Start the highest priority queued job once the panel is free. Only one
+// task owns crestronTask, simpleTask and taskStep at a time
+void TexecomClass::runNextJob() {
+    if (crestronTask != CRESTRON_IDLE ||
+            simpleTask != SIMPLE_IDLE ||
+            activeProtocol != CRESTRON ||
+            crestronHelper.queuedCommands() > 0)
+        return;
+
+    JobQueue::JOB_TYPE type;
+    JobQueue::JOB job;
+
+    if (!jobQueue.next(&type, &job, millis()))
+        return;
+
+    switch (type) {
+        case JobQueue::JOB_DISARM :
+            strcpy(userPin, job.pin);
+            taskRequestTime = job.queuedTime;
+            disarm();
+            break;
+        case JobQueue::JOB_ARM :
+            strcpy(userPin, job.pin);
+            armType = (ARM_TYPE) job.armType;
+            taskRequestTime = job.queuedTime;
+            arm();
+            break;
+        case JobQueue::JOB_ZONE_SYNC :
+            syncZones();
+            break;
+        case JobQueue::JOB_TIME_SYNC :
+            syncTime();
+            break;
+    }
 }
 
 void TexecomClass::arm() {
@@ -95,48 +384,224 @@ void TexecomClass::arm() {
     armSystem(RESULT_NONE);
 }
 
-void TexecomClass::delayCommand(CrestronHelper::CRESTRON_COMMAND command, int delay) {
-    delayedCommand = command;
-    delayedCommandExecuteTime = millis() + delay;
+void TexecomClass::enterUserPin() {
+    uint8_t pinLength = strlen(userPin);
+    int keyDelay = fastPath ? FAST_PIN_ENTRY_DELAY : PIN_ENTRY_DELAY;
+
+    // Queue every digit up front. The last one completes the login
+    for (uint8_t i = 0; i < pinLength; i++)
+        crestronHelper.sendKey(userPin[i], i * keyDelay,
+                                (i == pinLength-1) ? userPinEntered : NULL, true);
+}
+
+void TexecomClass::userPinEntered() {
+    Texecom.processTask(CRESTRON_LOGIN_COMPLETE);
 }
 
 void TexecomClass::updateAlarmState() {
     if (alarmCallback)
         alarmCallback(alarmState, alarmStateFlags);
+
+    if (stateLatencyPending) {
+        stateStats.lastLatency = micros() - stateChangeMicros;
+        stateLatencyPending = false;
+    }
     
+    // Flag and link changes come through here too, so only act on entering
+    // TRIGGERED. The sync reads the alarmed zones to confirm the trigger
     if (alarmState == TRIGGERED) {
-        Alarm.timerOnce(1, startZoneSync);
+        if (!triggerSeen) {
+            triggerSeen = true;
+            if (triggerSource == TRIGGER_NONE)
+                attributeTrigger(findRecentZone(), TRIGGER_RECENT_ZONE);
+            requestZoneSync(true);
+        }
+    } else {
+        triggerSeen = false;
+        triggerSource = TRIGGER_NONE;
+    }
+}
+
+// Lists up to maxZones zones, with their flags, that are stopping the
+// system arming, from the zone state already held. Returns how many there
+// are in total.
+uint16_t TexecomClass::getBlockingZones(uint16_t *zones, uint8_t *states, uint16_t maxZones) {
+    uint16_t found = zoneStore.findBlocking(zones, maxZones);
+
+    for (uint16_t i = 0; i < found; i++) {
+        states[i] = zoneStore.get(zones[i]);
+        zones[i] = zoneMap.zoneNumber(zones[i]);
     }
+    return zoneStore.getBlockingCount();
+}
+
+// Publishes the zone behind the alarm, unless it's already known from an
+// equal or better source. Zone 0 is no zone, so nothing is published until
+// one is found
+void TexecomClass::attributeTrigger(uint16_t zone, TRIGGER_SOURCE source) {
+    if (zone == 0 || source < triggerSource || (source == triggerSource && zone == triggerZone))
+        return;
+
+    Log.info("TRIGGER: Zone %d, source %d", zone, source);
+    triggerZone = zone;
+    triggerSource = source;
+
+    if (triggerCallback)
+        triggerCallback(zone, source);
+}
+
+// The latest zone to go active or tampered within the window, 0 if none
+uint16_t TexecomClass::findRecentZone() {
+    uint8_t slot = (recentZoneSlot + recentZoneCount - 1) % recentZoneCount;
+    const ZONE_EVENT &latest = recentZones[slot];
+
+    if (latest.zone == 0 || millis() - latest.time > recentZoneWindow)
+        return 0;
+    return latest.zone;
+}
+
+// Once every zone has been read, the alarmed flag shows which zone caused
+// the alarm. The zone published earlier is kept if it's among them.
+void TexecomClass::confirmTrigger() {
+    if (alarmState != TRIGGERED || triggerSource == TRIGGER_ZONE_SYNC)
+        return;
+
+    int16_t index = triggerZone ? zoneMap.indexOf(triggerZone) : -1;
+
+    if (index < 0 || !(zoneStore.get(index) & ZONE_ALARMED)) {
+        index = zoneStore.findFirst(ZoneStore::PLANE_ALARMED);
+        if (index < 0)
+            return;
+    }
+
+    attributeTrigger(zoneMap.zoneNumber(index), TRIGGER_ZONE_SYNC);
+}
+
+// Returns true when the state changed. The caller then calls updateAlarmState()
+bool TexecomClass::setAlarmState(ALARM_STATE state, STATE_SOURCE source, uint32_t detectedMicros) {
+    if (state == alarmState) {
+        if (!stateConfirmed && source != stateSource) {
+            stateConfirmed = true;
+            // A frame is timestamped on arrival so may predate the output poll
+            int32_t lead = detectedMicros - stateChangeMicros;
+            stateStats.lastLead = lead > 0 ? lead : 0;
+        }
+        return false;
+    }
+
+    alarmState = state;
+    exitToDisarmTimeout = 0;
+
+    // The screen follows the state, and exit is neither armed nor disarmed
+    screenCache.time = 0;
+    armStateCache.result = (state == DISARMED) ? CRESTRON_IS_DISARMED : CRESTRON_IS_ARMED;
+    armStateCache.time = (state == EXIT) ? 0 : millis();
+    stateSource = source;
+    stateChangeMicros = detectedMicros;
+    stateConfirmed = false;
+    stateLatencyPending = true;
+
+    stateStats.lastSource = source;
+    stateStats.lastLead = 0;
+    if (source == SOURCE_CRESTRON)
+        stateStats.crestronFirst++;
+    else
+        stateStats.digiOutputFirst++;
+
+    if (crestronTask != CRESTRON_IDLE) {
+        if (state == EXIT)
+            processTask(CRESTRON_IS_ARMING);
+        else if (state == DISARMED)
+            processTask(CRESTRON_IS_DISARMED);
+    }
+
+    return true;
+}
+
+// "A0, "D0 and "X0 carry the user, "E0 and "L0 the zone, followed by the area
+void TexecomClass::decodeAreaEvent(CrestronMatcher::MESSAGE_TYPE type, char *message, uint32_t receivedMicros) {
+    char number[4];
+    memcpy(number, &message[2], 3);
+    number[3] = '\0';
+
+    stateStats.lastUser = atoi(number);
+    stateStats.lastArea = message[5] - '0';
+
+    ALARM_STATE state;
+
+    switch (type) {
+        case CrestronMatcher::MESSAGE_ARM_UPDATE :
+            // The event doesn't say how the area was armed. Use our own arm
+            // request or the armed outputs, otherwise leave it to the outputs
+            if ((crestronTask == CRESTRON_ARM && armType == NIGHT_ARM) || digiOutputs.getLevel(DigiOutputs::OUTPUT_PART_ARMED) == LOW) {
+                state = ARMED_HOME;
+            } else if ((crestronTask == CRESTRON_ARM && armType == FULL_ARM) || digiOutputs.getLevel(DigiOutputs::OUTPUT_FULL_ARMED) == LOW) {
+                state = ARMED_AWAY;
+            } else {
+                Log.info("STATE: Area %d armed, waiting for outputs", stateStats.lastArea);
+                return;
+            }
+            break;
+        case CrestronMatcher::MESSAGE_DISARM_UPDATE :
+            state = DISARMED;
+            break;
+        case CrestronMatcher::MESSAGE_ENTRY_UPDATE :
+            state = ENTRY;
+            break;
+        case CrestronMatcher::MESSAGE_ARMING_UPDATE :
+            state = EXIT;
+            break;
+        case CrestronMatcher::MESSAGE_INTRUDER_UPDATE :
+            state = TRIGGERED;
+            break;
+        default :
+            return;
+    }
+
+    bool changed = setAlarmState(state, SOURCE_CRESTRON, receivedMicros);
+
+    // The intruder event names the zone that caused it, which beats
+    // guessing from the recent zones
+    if (type == CrestronMatcher::MESSAGE_INTRUDER_UPDATE && stateStats.lastUser != 0)
+        attributeTrigger(stateStats.lastUser, TRIGGER_INTRUDER_EVENT);
+
+    if (changed)
+        updateAlarmState();
 }
 
 void TexecomClass::decodeZoneState(char *message) {
-    uint8_t zone;
+    int16_t zone;
     uint8_t state;
 
     char zoneChar[4];
     memcpy(zoneChar, &message[2], 3);
     zoneChar[3] = '\0';
-    zone = atoi(zoneChar) - firstZone;
+    zone = zoneMap.indexOf(atoi(zoneChar));
+
+    if (zone < 0)  // Not a configured zone
+        return;
 
     state = message[5] - '0';
 
-    if (state == 0) { // Healthy
-        zoneStates[zone] &= ~ZONE_ACTIVE;
-        zoneStates[zone] &= ~ZONE_TAMPER;
-    } else if (state == 1) { // Active
-        zoneStates[zone] |= ZONE_ACTIVE;
-        zoneStates[zone] &= ~ZONE_TAMPER;
-    } else if (state == 2) { // Tamper
-        zoneStates[zone] &= ~ZONE_ACTIVE;
-        zoneStates[zone] |= ZONE_TAMPER;
+    if (state <= 2) { // Healthy, Active or Tamper
+        zoneStore.setPlane(zone, ZoneStore::PLANE_ACTIVE, state == 1);
+        zoneStore.setPlane(zone, ZoneStore::PLANE_TAMPER, state == 2);
     }
 
+    if (state == 1 || state == 2) {
+        recentZones[recentZoneSlot].zone = zoneMap.zoneNumber(zone);
+        recentZones[recentZoneSlot].time = millis();
+        recentZoneSlot = (recentZoneSlot + 1) % recentZoneCount;
+    }
+
+    // Crestron only reports active and tamper, the next sync reads the rest
+    suspectZones[zone / 32] |= 1UL << (zone % 32);
     updateZoneState(zone);
 }
 
-void TexecomClass::updateZoneState(uint8_t zone) {
+void TexecomClass::updateZoneState(uint16_t index) {
     if (zoneCallback)
-        zoneCallback(zone+firstZone, zoneStates[zone]);
+        zoneCallback(zoneMap.zoneNumber(index), zoneStore.get(index));
 }
 
 void TexecomClass::processTask(TASK_STEP_RESULT result) {
@@ -145,6 +610,8 @@ void TexecomClass::processTask(TASK_STEP_RESULT result) {
 
     if (taskStep == SIMPLE_LOGIN) {
         simpleLogin(result);
+    } else if (activeProtocol == SIMPLE && taskStep == SIMPLE_LOGOUT) {
+        endSimpleSession(result);
     } else if (activeProtocol == SIMPLE) {
         if (simpleTask == SIMPLE_CHECK_TIME) {
             checkTime(result);
@@ -160,25 +627,155 @@ void TexecomClass::processTask(TASK_STEP_RESULT result) {
     }
 }
 
+void TexecomClass::cacheResult(TASK_STEP_RESULT result) {
+    if (result == CRESTRON_IS_ARMED || result == CRESTRON_IS_DISARMED) {
+        armStateCache.result = result;
+        armStateCache.time = millis();
+    } else if (isScreenResult(result)) {
+        screenCache.result = result;
+        screenCache.time = millis();
+    }
+}
+
+bool TexecomClass::isCacheFresh(const CACHED_RESULT &entry, uint32_t validAfter) {
+    return entry.time != 0 &&
+            (int32_t) (entry.time - validAfter) >= 0 &&
+            millis() - entry.time <= cacheMaxAge;
+}
+
+TexecomClass::TASK_STEP_RESULT TexecomClass::getCachedResult(const CACHED_RESULT &entry, uint32_t validAfter) {
+    if (isCacheFresh(entry, validAfter)) {
+        cacheStats.hits++;
+        return entry.result;
+    }
+
+    cacheStats.misses++;
+    return RESULT_NONE;
+}
+
+// Ask for the arm state and, unless it is already known, the screen in one
+// go. The screen reply is cached until the idle screen step wants it
+void TexecomClass::startConfirmation() {
+    if (!isCacheFresh(screenCache, crestronHelper.lastKeyTime()))
+        crestronHelper.requestScreen();
+
+    confirmArmState();
+}
+
+void TexecomClass::confirmArmState() {
+    TASK_STEP_RESULT cached = getCachedResult(armStateCache, 0);
+
+    if (cached != RESULT_NONE)
+        processTask(cached);
+    else
+        crestronHelper.requestArmState();
+}
+
+// A screen seen before the last key press may already have moved on
+void TexecomClass::confirmScreen() {
+    TASK_STEP_RESULT cached = getCachedResult(screenCache, crestronHelper.lastKeyTime());
+
+    if (cached != RESULT_NONE)
+        processTask(cached);
+    else if (!crestronHelper.isOutstanding(CrestronHelper::COMMAND_SCREEN_STATE))
+        crestronHelper.requestScreen();
+}
+
+// Read the screen straight after the last digit. The panel acts on keys
+// and requests in order, so the reply shows whether the code was taken
+void TexecomClass::startLoginWait() {
+    taskStep = CRESTRON_LOGIN_WAIT;
+    loginIdleSeen = false;
+    loginScreenLeft = false;
+    crestronHelper.requestScreen();
+}
+
+// A wrong code gets no reply, the keypad just stays where it was. A slow
+// panel can show that same screen for a while before "U0 arrives, so it
+// only counts as a rejection once the learned login window has passed,
+// or after the keypad has left it and come back. An invalid code screen,
+// if one is configured, is a rejection straight away
+bool TexecomClass::isLoginRejected(TASK_STEP_RESULT result) {
+    if (result == CRESTRON_SCREEN_INVALID_CODE)
+        return true;
+
+    if (!isScreenResult(result))
+        return false;
+
+    if (result == CRESTRON_SCREEN_IDLE ||
+            result == CRESTRON_SCREEN_PART_ARMED ||
+            result == CRESTRON_SCREEN_FULL_ARMED ||
+            result == CRESTRON_SCREEN_AREA_ENTRY) {
+        if (loginIdleSeen &&
+                (loginScreenLeft || millis() - crestronHelper.lastKeyTime() > loginEstimate.timeout))
+            return true;
+        loginIdleSeen = true;
+    } else if (loginIdleSeen) {
+        loginScreenLeft = true;
+    }
+
+    crestronHelper.request(CrestronHelper::COMMAND_SCREEN_STATE, SCREEN_POLL_INTERVAL);
+    return false;
+}
+
+void TexecomClass::waitForScreen(TASK_STEP step) {
+    taskStep = step;
+    stepStartTime = millis();
+    // Requeue behind any key just sent so the reply reflects it
+    crestronHelper.cancel(CrestronHelper::COMMAND_SCREEN_STATE);
+    crestronHelper.request(CrestronHelper::COMMAND_SCREEN_STATE,
+                            fastPath ? SCREEN_POLL_INTERVAL : PROMPT_WAIT_DELAY);
+}
+
+// In fast path a wrong screen may just be one the panel hasn't moved on
+// from yet, so poll again until PROMPT_WAIT_DELAY has passed
+bool TexecomClass::retryScreenWait() {
+    if (!fastPath || millis() > stepStartTime + PROMPT_WAIT_DELAY)
+        return false;
+
+    crestronHelper.request(CrestronHelper::COMMAND_SCREEN_STATE, SCREEN_POLL_INTERVAL);
+    return true;
+}
+
+bool TexecomClass::isScreenResult(TASK_STEP_RESULT result) {
+    switch (result) {
+        case CRESTRON_SCREEN_IDLE :
+        case CRESTRON_SCREEN_PART_ARMED :
+        case CRESTRON_SCREEN_FULL_ARMED :
+        case CRESTRON_SCREEN_AREA_ENTRY :
+        case CRESTRON_SCREEN_AREA_EXIT :
+        case CRESTRON_SCREEN_INVALID_CODE :
+        case CRESTRON_FULL_ARM_PROMPT :
+        case CRESTRON_PART_ARM_PROMPT :
+        case CRESTRON_NIGHT_ARM_PROMPT :
+        case CRESTRON_DISARM_PROMPT :
+            return true;
+        default :
+            return false;
+    }
+}
+
 void TexecomClass::disarmSystem(TASK_STEP_RESULT result) {
     switch (taskStep) {
         case CRESTRON_START :
             disarmStartTime = millis();
             Log.info("DISARM: Starting disarm process");
             taskStep = CRESTRON_CONFIRM_ARMED;
-            crestronHelper.requestArmState();
+            startConfirmation();
             break;
 
         case CRESTRON_CONFIRM_ARMED :
             if (result == CRESTRON_IS_ARMED) {
                 Log.info("DISARM: Confirmed armed. Confirming idle screen");
                 taskStep = CRESTRON_CONFIRM_IDLE_SCREEN;
-                crestronHelper.requestScreen();
+                confirmScreen();
             } else if (result == CRESTRON_IS_DISARMED) {
                 Log.info("DISARM: System already armed. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Already disarmed");
+            } else if (isScreenResult(result)) {
+                // Reply to the screen request sent alongside, now cached
             } else {
-                abortCrestronTask();
+                abortCrestronTask("Arm state unknown");
             }
             break;
 
@@ -190,67 +787,82 @@ void TexecomClass::disarmSystem(TASK_STEP_RESULT result) {
                 result == CRESTRON_SCREEN_AREA_ENTRY) {
                 Log.info("DISARM: Idle screen confirmed. Starting login process");
                 taskStep = CRESTRON_LOGIN;
+                enterUserPin();
             } else {
                 Log.info("DISARM: Screen is not idle. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Keypad is in use");
             }
             break;
 
         case CRESTRON_LOGIN:
             if (result == CRESTRON_LOGIN_COMPLETE) {
                 Log.info("DISARM: Login complete. Awaiting confirmed login");
-                taskStep = CRESTRON_LOGIN_WAIT;
+                startLoginWait();
             } else {
                 Log.info("DISARM: Login failed. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("User code could not be entered");
             }
             break;
 
         case CRESTRON_LOGIN_WAIT :
             if (result == CRESTRON_LOGIN_CONFIRMED) {
+                CrestronHelper::updateEstimate(&loginEstimate, millis() - crestronHelper.lastKeyTime(),
+                                                minLoginWindow, commandWaitTimeout);
                 if (alarmState != ENTRY) {
                     Log.info("DISARM: Login confirmed. Waiting for Disarm prompt");
-                    taskStep = CRESTRON_WAIT_FOR_DISARM_PROMPT;
-                    delayCommand(CrestronHelper::COMMAND_SCREEN_STATE, 500);
+                    waitForScreen(CRESTRON_WAIT_FOR_DISARM_PROMPT);
                 } else {
                     Log.info("DISARM: Login confirmed. Waiting for Disarm confirmation");
+                    crestronHelper.cancel(CrestronHelper::COMMAND_SCREEN_STATE);
                     taskStep = CRESTRON_DISARM_REQUESTED;
                 }
+            } else if (isLoginRejected(result)) {
+                Log.info("DISARM: User code rejected. Aborting");
+                abortCrestronTask("Incorrect user code");
+            } else if (isScreenResult(result)) {
+                // Panel hasn't acted on the last digit yet
             } else {
                 Log.info("DISARM: Login failed to confirm. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("User code was not accepted");
             }
             break;
 
         case CRESTRON_WAIT_FOR_DISARM_PROMPT :
             if (result == CRESTRON_DISARM_PROMPT) {
                 Log.info("DISARM: Disarm prompt confirmed, disarming");
+                crestronHelper.cancel(CrestronHelper::COMMAND_SCREEN_STATE);
                 if (!savedData.isDebug)
-                    texSerial.println("KEYY");  // Yes
+                    crestronHelper.sendKey('Y');  // Yes
 
                 taskStep = CRESTRON_DISARM_REQUESTED;
-            } else {
+            } else if (!retryScreenWait()) {
                 Log.info("DISARM: Unexpected result at WAIT_FOR_DISARM_PROMPT. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Disarm prompt not shown");
             }
             break;
 
         case CRESTRON_DISARM_REQUESTED :
             if (result == CRESTRON_IS_DISARMED) {
-                Log.info("DISARM: DISARM CONFIRMED");
+                crestronHelper.matchKeyResponse();
+                CrestronHelper::updateEstimate(&disarmEstimate, millis() - crestronHelper.lastKeyTime(),
+                                                minStateChangeWindow, disarmTimeout);
+                taskStats.lastDisarmLatency = millis() - taskRequestTime;
+                taskStats.disarmCount++;
+                Log.info("DISARM: DISARM CONFIRMED after %lums", taskStats.lastDisarmLatency);
                 crestronTask = CRESTRON_IDLE;
                 memset(userPin, 0, sizeof userPin);
                 disarmStartTime = 0;
-                Alarm.completeTriggeredAlarm();
+            } else if (isScreenResult(result)) {
+                // Screens the panel shows while it acts on the key
             } else {
                 Log.info("DISARM: Unexpected result at DISARM_REQUESTED. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Disarm was not confirmed");
             }
             break;
     }
 
     if (result == CRESTRON_TASK_TIMEOUT && crestronTask != CRESTRON_IDLE)
-        abortCrestronTask();
+        abortCrestronTask("Timed out");
 }
 
 void TexecomClass::armSystem(TASK_STEP_RESULT result) {
@@ -266,19 +878,21 @@ void TexecomClass::armSystem(TASK_STEP_RESULT result) {
             armStartTime = millis();
             Log.info("ARM: Requesting arm state");
             taskStep = CRESTRON_CONFIRM_DISARMED;
-            crestronHelper.requestArmState();
+            startConfirmation();
             break;
 
         case CRESTRON_CONFIRM_DISARMED:
             if (result == CRESTRON_IS_DISARMED) {
                 Log.info("ARM: Confirmed disarmed. Confirming idle screen");
                 taskStep = CRESTRON_CONFIRM_IDLE_SCREEN;
-                crestronHelper.requestScreen();
+                confirmScreen();
             } else if (result == CRESTRON_IS_ARMED) {
                 Log.info("ARM: System already armed. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Already armed");
+            } else if (isScreenResult(result)) {
+                // Reply to the screen request sent alongside, now cached
             } else {
-                abortCrestronTask();
+                abortCrestronTask("Arm state unknown");
             }
             break;
 
@@ -286,30 +900,37 @@ void TexecomClass::armSystem(TASK_STEP_RESULT result) {
             if (result == CRESTRON_SCREEN_IDLE) {
                 Log.info("ARM: Idle screen confirmed. Starting login process");
                 taskStep = CRESTRON_LOGIN;
+                enterUserPin();
             } else {
                 Log.info("ARM: Screen is not idle. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Keypad is in use");
             }
             break;
 
         case CRESTRON_LOGIN:
             if (result == CRESTRON_LOGIN_COMPLETE) {
                 Log.info("ARM: Login complete. Awaiting confirmed login");
-                taskStep = CRESTRON_LOGIN_WAIT;
+                startLoginWait();
             } else {
                 Log.info("ARM: Login failed. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("User code could not be entered");
             }
             break;
 
         case CRESTRON_LOGIN_WAIT :
             if (result == CRESTRON_LOGIN_CONFIRMED) {
+                CrestronHelper::updateEstimate(&loginEstimate, millis() - crestronHelper.lastKeyTime(),
+                                                minLoginWindow, commandWaitTimeout);
                 Log.info("ARM: Login confirmed. Waiting for Arm prompt");
-                taskStep = CRESTRON_WAIT_FOR_ARM_PROMPT;
-                delayCommand(CrestronHelper::COMMAND_SCREEN_STATE, 500);
+                waitForScreen(CRESTRON_WAIT_FOR_ARM_PROMPT);
+            } else if (isLoginRejected(result)) {
+                Log.info("ARM: User code rejected. Aborting");
+                abortCrestronTask("Incorrect user code");
+            } else if (isScreenResult(result)) {
+                // Panel hasn't acted on the last digit yet
             } else {
                 Log.info("ARM: Login failed to confirm. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("User code was not accepted");
             }
             break;
 
@@ -317,61 +938,67 @@ void TexecomClass::armSystem(TASK_STEP_RESULT result) {
             if (result == CRESTRON_FULL_ARM_PROMPT) {
                 if (armType == FULL_ARM) {
                     Log.info("ARM: Full arm prompt confirmed, completing full arm");
+                    crestronHelper.cancel(CrestronHelper::COMMAND_SCREEN_STATE);
                     if (!savedData.isDebug)
-                        texSerial.println("KEYY");  // Yes
+                        crestronHelper.sendKey('Y');  // Yes
                     taskStep = CRESTRON_ARM_REQUESTED;
                 } else if (armType == NIGHT_ARM) {
                     Log.info("ARM: Full arm prompt confirmed, waiting for part arm prompt");
-                    taskStep = CRESTRON_WAIT_FOR_PART_ARM_PROMPT;
-                    texSerial.println("KEYD");  // Down
-                    delayCommand(CrestronHelper::COMMAND_SCREEN_STATE, 500);
+                    crestronHelper.sendKey('D');  // Down
+                    waitForScreen(CRESTRON_WAIT_FOR_PART_ARM_PROMPT);
                 }
-            } else {
+            } else if (!retryScreenWait()) {
                 Log.info("ARM: Unexpected result at WAIT_FOR_ARM_PROMPT. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Arm prompt not shown");
             }
             break;
 
         case CRESTRON_WAIT_FOR_PART_ARM_PROMPT :
             if (result == CRESTRON_PART_ARM_PROMPT) {
                 Log.info("ARM: Part arm prompt confirmed, waiting for night arm prompt");
-                taskStep = CRESTRON_WAIT_FOR_NIGHT_ARM_PROMPT;
-                texSerial.println("KEYY");  // Yes
-                delayCommand(CrestronHelper::COMMAND_SCREEN_STATE, 500);
-            } else {
+                crestronHelper.sendKey('Y');  // Yes
+                waitForScreen(CRESTRON_WAIT_FOR_NIGHT_ARM_PROMPT);
+            } else if (!retryScreenWait()) {
                 Log.info("ARM: Unexpected result at WAIT_FOR_PART_ARM_PROMPT. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Part arm prompt not shown");
             }
             break;
 
         case CRESTRON_WAIT_FOR_NIGHT_ARM_PROMPT :
             if (result == CRESTRON_NIGHT_ARM_PROMPT) {
                 Log.info("ARM: Night arm prompt confirmed, Completing part arm");
+                crestronHelper.cancel(CrestronHelper::COMMAND_SCREEN_STATE);
                 if (!savedData.isDebug)
-                    texSerial.println("KEYY");  // Yes
+                    crestronHelper.sendKey('Y');  // Yes
                 taskStep = CRESTRON_ARM_REQUESTED;
-            } else {
+            } else if (!retryScreenWait()) {
                 Log.info("ARM: Unexpected result at WAIT_FOR_NIGHT_ARM_PROMPT. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Night arm prompt not shown");
             }
             break;
 
         case CRESTRON_ARM_REQUESTED :
             if (result == CRESTRON_IS_ARMING) {
-                Log.info("ARM: ARM CONFIRMED");
+                crestronHelper.matchKeyResponse();
+                CrestronHelper::updateEstimate(&armEstimate, millis() - crestronHelper.lastKeyTime(),
+                                                minStateChangeWindow, armTimeout);
+                taskStats.lastArmLatency = millis() - taskRequestTime;
+                taskStats.armCount++;
+                Log.info("ARM: ARM CONFIRMED after %lums", taskStats.lastArmLatency);
                 crestronTask = CRESTRON_IDLE;
                 memset(userPin, 0, sizeof userPin);
                 armStartTime = 0;
-                Alarm.completeTriggeredAlarm();
+            } else if (isScreenResult(result)) {
+                // Screens the panel shows while it acts on the key
             } else {
                 Log.info("ARM: Unexpected result at ARM_REQUESTED. Aborting");
-                abortCrestronTask();
+                abortCrestronTask("Arm was not confirmed");
             }
             break;
     }
 
     if (result == CRESTRON_TASK_TIMEOUT && crestronTask != CRESTRON_IDLE)
-        abortCrestronTask();
+        abortCrestronTask("Timed out");
 }
 
 void TexecomClass::simpleLogin(TASK_STEP_RESULT result) {
@@ -380,6 +1007,8 @@ void TexecomClass::simpleLogin(TASK_STEP_RESULT result) {
             if (activeProtocol != SIMPLE) {
                 Log.info("SIMPLE: Starting login process");
                 taskStep = SIMPLE_LOGIN;
+                simpleLoginAttempts = 0;
+                simpleLoginFrameCount = serialStats.frameCount;
             }
             break;
         case SIMPLE_LOGIN :
@@ -387,15 +1016,7 @@ void TexecomClass::simpleLogin(TASK_STEP_RESULT result) {
                 Log.info("SIMPLE: Simple login confirmed");
                 activeProtocol = SIMPLE;
                 simpleProtocolTimeout = millis() + 30000;
-                taskStep = SIMPLE_START;
-                switch (simpleTask) {
-                    case SIMPLE_CHECK_TIME :
-                        checkTime(SIMPLE_LOGIN_CONFIRMED);
-                        break;
-                    case SIMPLE_ZONE_CHECK :
-                        zoneCheck(SIMPLE_LOGIN_CONFIRMED);
-                        break;
-                }
+                nextSimpleOperation();
             } else {
                 Log.info("SIMPLE: Uh oh 1 - %d", result);
             }
@@ -412,9 +1033,8 @@ void TexecomClass::checkTime(TASK_STEP_RESULT result) {
             break;
         case SIMPLE_REQUEST_TIME :
             if (result == SIMPLE_TIME_CHECK_OK) {
-                Log.info("TIME: Time ok, logging out");
-                simpleHelper.sendSimpleMessage("\\H/", 3);
-                taskStep = SIMPLE_LOGOUT;
+                Log.info("TIME: Time ok");
+                nextSimpleOperation();
             } else if (result == SIMPLE_TIME_CHECK_OUT) {
                 Log.info("TIME: Time is out, Setting time");
                 char setTimeMsg[8];
@@ -434,19 +1054,8 @@ void TexecomClass::checkTime(TASK_STEP_RESULT result) {
             }
             break;
         case SIMPLE_SEND_TIME :
-            Log.info("TIME: Time set, logging out");
-            simpleHelper.sendSimpleMessage("\\H/", 3);
-            taskStep = SIMPLE_LOGOUT;
-            break;
-        case SIMPLE_LOGOUT :
-            if (result == SIMPLE_OK) {
-                Log.info("TIME: Logout confirmed");
-                activeProtocol = CRESTRON;
-                simpleTask = SIMPLE_IDLE;
-                Alarm.completeTriggeredAlarm();
-            } else {
-                Log.info("TIME: Uh oh Time 2 - %d", result);
-            }
+            Log.info("TIME: Time set");
+            nextSimpleOperation();
             break;
     }
 }
@@ -454,179 +1063,207 @@ void TexecomClass::checkTime(TASK_STEP_RESULT result) {
 void TexecomClass::zoneCheck(TASK_STEP_RESULT result) {
     switch (taskStep) {
         case SIMPLE_START :
-            Log.info("ZONE: Requesting Zone state");
-            taskStep = SIMPLE_READ_ZONE_STATE;
-            char zoneRequestMessage[5];
-            zoneRequestMessage[0] = '\\';
-            zoneRequestMessage[1] = 'Z';
-            zoneRequestMessage[2] = firstZone-1;
-            zoneRequestMessage[3] = zoneCount;
-            zoneRequestMessage[4] = '/';
-            simpleHelper.sendSimpleMessage(zoneRequestMessage, 5); //  \ Z 8 11 /
+            zoneReadCursor = 0;
+            requestZoneRead();
             break;
         case SIMPLE_READ_ZONE_STATE :
-            Log.info("ZONE: zoneCheck Logging Out");
-            simpleHelper.sendSimpleMessage("\\H/", 3);
-            taskStep = SIMPLE_LOGOUT;
-            break;
-        case SIMPLE_LOGOUT :
-            if (result == SIMPLE_OK) {
-                Log.info("ZONE: Logout confirmed");
-            } else {
-                Log.info("ZONE: Uh oh 1 - %d", result);
-            }
-            activeProtocol = CRESTRON;
-            simpleTask = SIMPLE_IDLE;
-            Alarm.completeTriggeredAlarm();
+            // A chunk that failed stays suspect for the next sync
+            zoneReadCursor = zoneRead.index + zoneRead.count;
+            requestZoneRead();
             break;
     }
 }
 
-void TexecomClass::abortCrestronTask() {
+// Suspect zones are read in chunks that each fit in one reply frame
+void TexecomClass::requestZoneRead() {
+    if (!zoneMap.nextRead(suspectZones, zoneReadCursor, maxZonesPerRead, &zoneRead)) {
+        Log.info("ZONE: Zone state read");
+        confirmTrigger();
+        nextSimpleOperation();
+        return;
+    }
+
+    Log.info("ZONE: Requesting state of zones %d-%d", zoneRead.zone,
+                zoneRead.zone+zoneRead.count-1);
+    taskStep = SIMPLE_READ_ZONE_STATE;
+    char zoneRequestMessage[5];
+    zoneRequestMessage[0] = '\\';
+    zoneRequestMessage[1] = 'Z';
+    zoneRequestMessage[2] = zoneRead.zone-1;
+    zoneRequestMessage[3] = zoneRead.count;
+    zoneRequestMessage[4] = '/';
+    simpleHelper.sendSimpleMessage(zoneRequestMessage, 5); //  \ Z 8 11 /
+}
+
+bool TexecomClass::hasSuspectZones() {
+    if (millis() - lastStaleSweep > zoneStaleAge) {
+        zoneMap.fill(suspectZones);
+        lastStaleSweep = millis();
+    }
+    return zoneMap.any(suspectZones);
+}
+
+// Each zone is reported as two status bytes. Zones that changed, or have
+// not been published yet, are published.
+void TexecomClass::processZoneData(const char *message, uint8_t messageLength) {
+    uint32_t changed[ZoneStore::maxBlockWords];
+    uint8_t count = min(zoneRead.count, (uint8_t) (messageLength / 2));
+
+    if (count == 0)
+        return;
+
+    uint8_t span = zoneStore.applyBlock(zoneRead.index, message, count, changed);
+    uint16_t firstWord = zoneRead.index / 32;
+    zoneStats.reads++;
+    zoneStats.zonesRead += count;
+
+    for (uint8_t w = 0; w < span; w++) {
+        uint32_t block = ZoneStore::blockMask(firstWord + w, zoneRead.index, count);
+        uint32_t publish = (changed[w] | ~publishedZones[firstWord + w]) & block;
+
+        suspectZones[firstWord + w] &= ~block;
+        publishedZones[firstWord + w] |= block;
+        zoneStats.suppressed += __builtin_popcount(block & ~publish);
+        zoneStats.published += __builtin_popcount(publish);
+
+        while (publish) {
+            updateZoneState((firstWord + w) * 32 + __builtin_ctz(publish));
+            publish &= publish - 1;
+        }
+    }
+}
+
+const TexecomClass::ZONE_STATS& TexecomClass::getZoneStats() {
+    zoneStats.active = zoneStore.countSet(ZoneStore::PLANE_ACTIVE);
+    zoneStats.tampered = zoneStore.countSet(ZoneStore::PLANE_TAMPER);
+    return zoneStats;
+}
+
+void TexecomClass::abortCrestronTask(const char *reason) {
+    Log.info("Task aborted: %s", reason);
+    if (failureCallback)
+        failureCallback(crestronTask, reason);
+
     crestronTask = CRESTRON_IDLE;
-    texSerial.println("KEYR");
-    delayedCommandExecuteTime = 0;
+    crestronHelper.clearQueue();
+    crestronHelper.sendKey('R');
     memset(userPin, 0, sizeof userPin);
-    nextPinEntryTime = 0;
     armStartTime = 0;
     disarmStartTime = 0;
     crestronHelper.requestArmState();
-    commandAttempts = 0;
-    Alarm.completeTriggeredAlarm();
 }
 
-bool TexecomClass::processCrestronMessage(char *message, uint8_t messageLength) {
+bool TexecomClass::processCrestronMessage(char *message, uint8_t messageLength, uint32_t receivedMicros) {
+    TASK_STEP_RESULT result = RESULT_NONE;
 
-    // Zone state changed
-    if (messageLength == 6 &&
-        strncmp(message, msgZoneUpdate, strlen(msgZoneUpdate)) == 0) {
-        decodeZoneState(message);
-        return true;
-    // System Armed
-    } else if (messageLength >= 6 &&
-                strncmp(message, msgArmUpdate, strlen(msgArmUpdate)) == 0) {
-        // if (crestronTask != CRESTRON_IDLE) {
-            // processTask(CRESTRON_IS_ARMED);
-        // }
-        return true;
-    // System Disarmed
-    } else if (messageLength >= 6 &&
-                strncmp(message, msgDisarmUpdate, strlen(msgDisarmUpdate)) == 0) {
-        // if (crestronTask != CRESTRON_IDLE) {
-            // processTask(CRESTRON_IS_DISARMED);
-        // }
-        return true;
-    // Entry while armed
-    } else if (messageLength == 6 &&
-                strncmp(message, msgEntryUpdate, strlen(msgEntryUpdate)) == 0) {
-        return true;
-    // System arming
-    } else if (messageLength == 6 &&
-                strncmp(message, msgArmingUpdate, strlen(msgArmingUpdate)) == 0) {
-        return true;
-    // Intruder
-    } else if (messageLength == 6 &&
-                strncmp(message, msgIntruderUpdate, strlen(msgIntruderUpdate)) == 0) {
-        return true;
-    // User logged in with code or tag
-    } else if (messageLength == 6 &&
-                (strncmp(message, msgUserPinLogin, strlen(msgUserPinLogin)) == 0 ||
-                strncmp(message, msgUserTagLogin, strlen(msgUserTagLogin)) == 0)) {
-        int user = message[4] - '0';
-
-        if (user < userCount)
-            Log.info("User logged in: %s", users[user]);
-        else
-            Log.info("User logged in: Outside of user array size");
+    CrestronMatcher::MESSAGE_TYPE type = crestronMatcher.classify(message, messageLength);
 
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_LOGIN_CONFIRMED);
-        }
-        return true;
-    // Reply to ASTATUS request that the system is disarmed
-    } else if (messageLength == 5 &&
-                strncmp(message, msgReplyDisarmed, strlen(msgReplyDisarmed)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_IS_DISARMED);
-        }
-        return true;
-    // Reply to ASTATUS request that the system is armed
-    } else if (messageLength == 5 &&
-                strncmp(message, msgReplyArmed, strlen(msgReplyArmed)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_IS_ARMED);
-        }
-        return true;
-    } else if (
-            (messageLength >= strlen(msgScreenArmedPart) &&
-                strncmp(message, msgScreenArmedPart, strlen(msgScreenArmedPart)) == 0) ||
-            (messageLength >= strlen(msgScreenArmedNight) &&
-                strncmp(message, msgScreenArmedNight, strlen(msgScreenArmedNight)) == 0) ||
-            (messageLength >= strlen(msgScreenIdlePartArmed) &&
-                strncmp(message, msgScreenIdlePartArmed, strlen(msgScreenIdlePartArmed)) == 0)) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_SCREEN_PART_ARMED);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenArmedFull) &&
-                strncmp(message, msgScreenArmedFull, strlen(msgScreenArmedFull)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_SCREEN_FULL_ARMED);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenIdle) &&
-                strncmp(message, msgScreenIdle, strlen(msgScreenIdle)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_SCREEN_IDLE);
-        }
-        return true;
-    // Shown directly after user logs in
-    } else if (messageLength > strlen(msgWelcomeBack) &&
-                strncmp(message, msgWelcomeBack, strlen(msgWelcomeBack)) == 0) {
-        if (taskStep == CRESTRON_WAIT_FOR_DISARM_PROMPT ||
-                taskStep == CRESTRON_WAIT_FOR_ARM_PROMPT) {
-            delayCommand(CrestronHelper::COMMAND_SCREEN_STATE, 500);
-        }
-        return true;
-    // Shown shortly after user logs in
-    } else if (messageLength >= strlen(msgScreenQuestionArm) &&
-                strncmp(message, msgScreenQuestionArm, strlen(msgScreenQuestionArm)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_FULL_ARM_PROMPT);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenQuestionPartArm) &&
-                strncmp(message, msgScreenQuestionPartArm, strlen(msgScreenQuestionPartArm)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_PART_ARM_PROMPT);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenQuestionNightArm) &&
-                strncmp(message, msgScreenQuestionNightArm, strlen(msgScreenQuestionNightArm)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_NIGHT_ARM_PROMPT);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenQuestionDisarm) &&
-                strncmp(message, msgScreenQuestionDisarm, strlen(msgScreenQuestionDisarm)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_DISARM_PROMPT);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenAreainEntry) &&
-                strncmp(message, msgScreenAreainEntry, strlen(msgScreenAreainEntry)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_SCREEN_AREA_ENTRY);
-        }
-        return true;
-    } else if (messageLength >= strlen(msgScreenAreainExit) &&
-        strncmp(message, msgScreenAreainExit, strlen(msgScreenAreainExit)) == 0) {
-        if (crestronTask != CRESTRON_IDLE) {
-            processTask(CRESTRON_SCREEN_AREA_EXIT);
+    switch (type) {
+        // Zone state changed
+        case CrestronMatcher::MESSAGE_ZONE_UPDATE :
+            decodeZoneState(message);
+            break;
+
+        // System armed, disarmed, entry while armed, arming and intruder
+        case CrestronMatcher::MESSAGE_ARM_UPDATE :
+        case CrestronMatcher::MESSAGE_DISARM_UPDATE :
+        case CrestronMatcher::MESSAGE_ENTRY_UPDATE :
+        case CrestronMatcher::MESSAGE_ARMING_UPDATE :
+        case CrestronMatcher::MESSAGE_INTRUDER_UPDATE :
+            decodeAreaEvent(type, message, receivedMicros);
+            break;
+
+        // User logged in with code or tag
+        case CrestronMatcher::MESSAGE_USER_LOGIN : {
+            int user = message[4] - '0';
+
+            if (user < userCount)
+                Log.info("User logged in: %s", users[user]);
+            else
+                Log.info("User logged in: Outside of user array size");
+
+            result = CRESTRON_LOGIN_CONFIRMED;
+            break;
         }
-        return true;
+
+        // Reply to ASTATUS request that the system is disarmed
+        case CrestronMatcher::MESSAGE_REPLY_DISARMED :
+            result = CRESTRON_IS_DISARMED;
+            break;
+
+        // Reply to ASTATUS request that the system is armed
+        case CrestronMatcher::MESSAGE_REPLY_ARMED :
+            result = CRESTRON_IS_ARMED;
+            break;
+
+        case CrestronMatcher::MESSAGE_SCREEN_PART_ARMED :
+            result = CRESTRON_SCREEN_PART_ARMED;
+            break;
+
+        case CrestronMatcher::MESSAGE_SCREEN_FULL_ARMED :
+            result = CRESTRON_SCREEN_FULL_ARMED;
+            break;
+
+        case CrestronMatcher::MESSAGE_SCREEN_IDLE :
+            result = CRESTRON_SCREEN_IDLE;
+            break;
+
+        // Shown directly after user logs in
+        case CrestronMatcher::MESSAGE_WELCOME_BACK :
+            screenCache.time = 0;
+            if (taskStep == CRESTRON_WAIT_FOR_DISARM_PROMPT ||
+                    taskStep == CRESTRON_WAIT_FOR_ARM_PROMPT) {
+                waitForScreen(taskStep);
+            }
+            break;
+
+        // Shown shortly after user logs in
+        case CrestronMatcher::MESSAGE_QUESTION_ARM :
+            result = CRESTRON_FULL_ARM_PROMPT;
+            break;
+
+        case CrestronMatcher::MESSAGE_QUESTION_PART_ARM :
+            result = CRESTRON_PART_ARM_PROMPT;
+            break;
+
+        case CrestronMatcher::MESSAGE_QUESTION_NIGHT_ARM :
+            result = CRESTRON_NIGHT_ARM_PROMPT;
+            break;
+
+        case CrestronMatcher::MESSAGE_QUESTION_DISARM :
+            result = CRESTRON_DISARM_PROMPT;
+            break;
+
+        case CrestronMatcher::MESSAGE_SCREEN_AREA_ENTRY :
+            result = CRESTRON_SCREEN_AREA_ENTRY;
+            break;
+
+        case CrestronMatcher::MESSAGE_SCREEN_AREA_EXIT :
+            result = CRESTRON_SCREEN_AREA_EXIT;
+            break;
+
+        case CrestronMatcher::MESSAGE_SCREEN_INVALID_CODE :
+            result = CRESTRON_SCREEN_INVALID_CODE;
+            break;
+
+        default :
+            screenCache.time = 0;  // Could be any screen
+            if (message[0] == '"')
+                crestronHelper.matchReply(CrestronHelper::COMMAND_SCREEN_STATE);
+            return false;
     }
-    return false;
+
+    if (result == CRESTRON_IS_ARMED || result == CRESTRON_IS_DISARMED)
+        crestronHelper.matchReply(CrestronHelper::COMMAND_ARMED_STATE);
+    else if (isScreenResult(result) || type == CrestronMatcher::MESSAGE_WELCOME_BACK)
+        crestronHelper.matchReply(CrestronHelper::COMMAND_SCREEN_STATE);
+
+    cacheResult(result);
+
+    if (result != RESULT_NONE && crestronTask != CRESTRON_IDLE)
+        processTask(result);
+
+    return true;
 }
 
 bool TexecomClass::processSimpleMessage(char *message, uint8_t messageLength) {
@@ -649,11 +1286,7 @@ bool TexecomClass::processSimpleMessage(char *message, uint8_t messageLength) {
             processTask(SIMPLE_TIME_CHECK_OUT);
         return true;
     } else if (taskStep == SIMPLE_READ_ZONE_STATE) {
-        simpleHelper.processReceivedZoneData(message, messageLength, zoneStates);
-
-        for (uint8_t i = 0; i < zoneCount; i++)
-            updateZoneState(i);
-
+        processZoneData(message, messageLength);
         processTask(SIMPLE_OK);
         return true;
     }
@@ -665,296 +1298,337 @@ bool TexecomClass::processSimpleMessage(char *message, uint8_t messageLength) {
 void TexecomClass::checkDigiOutputs() {
 
     bool changeDetected = false;
-
-    bool _state = digitalRead(pinFullArmed);
-
-    if (_state != statePinFullArmed) {
-        statePinFullArmed = _state;
-        if (_state == LOW) {
-            // Log.info("Pin Full Armed");
-            changeDetected = true;
-            alarmState = ARMED_AWAY;
-        }
-    }
-
-    _state = digitalRead(pinPartArmed);
-
-    if (_state != statePinPartArmed) {
-        statePinPartArmed = _state;
-        if (_state == LOW) {
-            // Log.info("Pin Part Armed");
-            changeDetected = true;
-            alarmState = ARMED_HOME;
-        }
+    uint32_t now = micros();
+    DigiOutputs::OUTPUT_EVENT event;
+
+    // Each change carries the time of its edge
+    while (digiOutputs.read(&event)) {
+        now = event.micros;
+        uint8_t active = ~digiOutputs.getLevels();
+        uint8_t changed = (active ^ lastActiveOutputs) & stateOutputs;
+        lastActiveOutputs = active;
+
+        // Any state output changing can move the state, either way. With
+        // none left active it is for the disarm check below
+        if (changed && digiStates.entry[active].state != noDigiState)
+            changeDetected |= setAlarmState((ALARM_STATE) digiStates.entry[active].state,
+                                            SOURCE_DIGI_OUTPUT, now);
     }
 
-    _state = digitalRead(pinEntry);
+    uint8_t flags = digiStates.entry[lastActiveOutputs].flags | (alarmStateFlags & ALARM_LINK_DOWN);
+    uint8_t flagsChanged = flags ^ alarmStateFlags;
 
-    if (_state != statePinEntry) {
-        statePinEntry = _state;
-        if (_state == LOW) {
-            // Log.info("Pin Entry");
-            changeDetected = true;
-            alarmState = ENTRY;
-        }
-    }
-
-    _state = digitalRead(pinExit);
-
-    if (_state != statePinExit) {
-        statePinExit = _state;
-        if (_state == LOW) {
-            // Log.info("Pin Exit");
-            changeDetected = true;
-            alarmState = EXIT;
-            if (crestronTask != CRESTRON_IDLE) {
-               processTask(CRESTRON_IS_ARMING);
-            }
-        }
-    }
-
-    _state = digitalRead(pinTriggered);
-
-    if (_state != statePinTriggered) {
-        statePinTriggered = _state;
-        if (_state == LOW) {
-            // Log.info("Pin Triggered");
-            changeDetected = true;
-            alarmState = TRIGGERED;
-        }
-    }
-
-    _state = digitalRead(pinAreaReady);
-
-    if (_state != statePinAreaReady) {
-        // Log.info("Pin Ready");
-        changeDetected = true;
-        statePinAreaReady = _state;
-
-        if (statePinAreaReady == LOW) {
-            alarmStateFlags |= ALARM_READY;
-        } else {
-            alarmStateFlags &= ~ALARM_READY;
-        }
-    }
-
-    _state = digitalRead(pinFaultPresent);
-
-    if (_state != statePinFaultPresent) {
-        // Log.info("Pin Fault");
+    if (flagsChanged) {
         changeDetected = true;
-        statePinFaultPresent = _state;
+        alarmStateFlags = flags;
 
-        if (statePinFaultPresent == LOW) {
-            alarmStateFlags |= ALARM_FAULT;
+        if (flagsChanged & flags & ALARM_FAULT)
             Log.error("Alarm is reporting a fault");
-        } else {
-            alarmStateFlags &= ~ALARM_FAULT;
+        else if (flagsChanged & ALARM_FAULT)
             Log.info("Alarm fault cleared");
-        }
-    }
-
-    _state = digitalRead(pinArmFailed);
-
-    if (_state != statePinArmFailed) {
-        // Log.info("Pin Arm Failed");
-        changeDetected = true;
-        statePinArmFailed = _state;
-
-        if (statePinArmFailed == LOW) {
-            alarmStateFlags |= ALARM_ARM_FAILED;
-            Log.error("Alarm failed to arm");
-        } else {
-            alarmStateFlags &= ~ALARM_ARM_FAILED;
-            Log.error("Alarm arm failure cleared");
-        }
+        if (flagsChanged & ALARM_ARM_FAILED)
+            Log.error(flags & ALARM_ARM_FAILED ? "Alarm failed to arm" : "Alarm arm failure cleared");
     }
 
+    bool statesClear = digiStates.entry[lastActiveOutputs].state == noDigiState;
 
-    // If no pins are high state must be disarmed
-    if (alarmState != DISARMED &&
-            statePinFullArmed == HIGH &&
-            statePinPartArmed == HIGH &&
-            statePinEntry == HIGH &&
-            statePinExit == HIGH &&
-            statePinTriggered == HIGH) {
+    // If no pins are high state must be disarmed. A state Crestron reported
+    // first isn't on the outputs yet, so wait for them to agree
+    if (alarmState != DISARMED && (stateSource == SOURCE_DIGI_OUTPUT || stateConfirmed) &&
+            statesClear) {
 
         if (alarmState == EXIT && exitToDisarmTimeout == 0) {
             // Log.info("Setting exit to disarm timeout");
             exitToDisarmTimeout = millis() + 1000;
         } else if (millis() > exitToDisarmTimeout) {
             // Log.info("No pin disarm timeout");
-            changeDetected = true;
-            alarmState = DISARMED;
+            changeDetected |= setAlarmState(DISARMED, SOURCE_DIGI_OUTPUT, now);
             exitToDisarmTimeout = 0;
-
-            if (crestronTask != CRESTRON_IDLE) {
-                processTask(CRESTRON_IS_DISARMED);
-            }
-
         }
+    } else if (alarmState == DISARMED && !stateConfirmed && statesClear) {
+        // Crestron reported the disarm first and the outputs now agree
+        setAlarmState(DISARMED, SOURCE_DIGI_OUTPUT, now);
     }
 
     if (changeDetected) {
         // lastStateChange = millis();
         updateAlarmState();
-        /*
-        Log.info("FA:%d PA:%d EN:%d EX:%d TR:%d AR:%d FP:%d AF:%d",
-            statePinFullArmed,
-            statePinPartArmed,
-            statePinEntry,
-            statePinExit,
-            statePinTriggered,
-            statePinAreaReady,
-            statePinFaultPresent,
-            statePinArmFailed);
-        */
     }
 
 }
 
+// Sends an ASTATUS only when nothing has been heard for a while, so real
+// traffic stands in for the heartbeat
+void TexecomClass::checkLink() {
+    uint32_t interval = isLinkUp() ? heartbeatInterval : downHeartbeatInterval;
+
+    if (activeProtocol != CRESTRON || simpleTask != SIMPLE_IDLE ||
+            millis() - lastFrameTime < interval ||
+            crestronHelper.queuedCommands() != 0 ||
+            crestronHelper.isOutstanding(CrestronHelper::COMMAND_ARMED_STATE))
+        return;
+
+    serialStats.heartbeats++;
+    lastFrameTime = millis();
+    crestronHelper.requestArmState();
+}
+
+void TexecomClass::setLinkDown() {
+    if (!isLinkUp())
+        return;
+
+    Log.error("Serial link down, alarm state from digi outputs only");
+    serialStats.linkDowns++;
+    alarmStateFlags |= ALARM_LINK_DOWN;
+
+    if (crestronTask != CRESTRON_IDLE)
+        abortCrestronTask("Serial link down");
+
+    // Fail queued arm and disarm requests now rather than at their deadline
+    if (jobQueue.isPending(JobQueue::JOB_ARM))
+        rejectWithoutLink(CRESTRON_ARM);
+    if (jobQueue.isPending(JobQueue::JOB_DISARM))
+        rejectWithoutLink(CRESTRON_DISARM);
+    for (uint8_t type = 0; type < JobQueue::JOB_TYPE_COUNT; type++)
+        jobQueue.cancel((JobQueue::JOB_TYPE) type);
+
+    updateAlarmState();
+}
+
+// Zones may have changed unseen while the link was down
+void TexecomClass::setLinkUp() {
+    Log.info("Serial link restored");
+    alarmStateFlags &= ~ALARM_LINK_DOWN;
+    updateAlarmState();
+    requestZoneSync(true);
+}
+
 void TexecomClass::setup() {
-    texSerial.begin(19200, SERIAL_8N2);  // open serial communications
+    texSerial.begin(texSerialBaudRate, SERIAL_8N2);  // open serial communications
+    crestronHelper.setRetryPolicy(commandWaitTimeout, maxRetries);
+    loginEstimate.timeout = commandWaitTimeout;
+    armEstimate.timeout = armTimeout;
+    disarmEstimate.timeout = disarmTimeout;
+    Recorder.begin(texSerialBaudRate);
+
+    digiOutputs.begin(digiOutputPins, digiOutputLevels);
 
-    pinMode(pinFullArmed, INPUT);
-    pinMode(pinPartArmed, INPUT);
-    pinMode(pinEntry, INPUT);
-    pinMode(pinExit, INPUT);
-    pinMode(pinTriggered, INPUT);
-    pinMode(pinArmFailed, INPUT);
-    pinMode(pinFaultPresent, INPUT);
-    pinMode(pinAreaReady, INPUT);
+    jobQueue.setExpiredCallback(jobExpired);
 
     EEPROM.get(0, savedData);
 
     if (savedData.isDebug)
         Log.info("UDL code = %s", savedData.udlCode);
 
+    // Unwritten EEPROM reads back as 0xFF so fails the version check
+    EEPROM.get(screenConfigAddress, screenConfig);
+    if (!CrestronMatcher::upgradeScreens(&screenConfig))
+        CrestronMatcher::getDefaultScreens(&screenConfig);
+    crestronMatcher.begin(&screenConfig);
+
+    EEPROM.get(zoneConfigAddress, zoneConfig);
+    if (!ZoneMap::isValid(&zoneConfig))
+        ZoneMap::getDefaultConfig(&zoneConfig, defaultFirstZone, defaultZoneCount);
+    configureZones();
+
     Alarm.timerRepeat(180, Texecom.startZoneSync);
     Alarm.alarmRepeat(3, 0, 0, Texecom.startTimeSync);
 
     checkDigiOutputs();
 }
 
-void TexecomClass::loop() {
+TexecomClass::FRAME* TexecomClass::readFrame() {
+    FRAME *frame = &framePool[frameSlot];
     bool messageReady = false;
-    bool messageComplete = true;
-    uint8_t messageLength = 0;
+    frame->complete = true;
 
-    // Read incoming serial data if available and copy to TCP port
+    // Drain the RX ring until one complete frame has been assembled
     while (texSerial.available() > 0) {
         int incomingByte = texSerial.read();
         // Log.info("S %d", incomingByte);
-        if (bufferPosition == 0)
-            messageStart = millis();
+        uint32_t now = micros();
+
+        // The first byte after a timed out frame shows how long the
+        // timeout should have waited
+        if (frame->length > 0 || lastFrameTimedOut)
+            updateByteGap(now - lastByteMicros);
+        lastFrameTimedOut = false;
+        lastByteMicros = now;
 
         // Will never happen but just in case
-        if (bufferPosition >= maxMessageSize) {
-            memcpy(message, buffer, bufferPosition);
-            message[bufferPosition] = '\0';
+        if (frame->length >= maxMessageSize) {
+            frame->data[frame->length] = '\0';
             messageReady = true;
-            messageLength = bufferPosition;
-            bufferPosition = 0;
             break;
         // 13+10 (CRLF) signifies the end of message
-        } else if (bufferPosition > 2 &&
+        } else if (frame->length > 2 &&
                    incomingByte == 10 &&
-                   buffer[bufferPosition-1] == 13) {
+                   frame->data[frame->length-1] == 13) {
             
             if (activeProtocol == SIMPLE || taskStep == SIMPLE_LOGIN) {
-                if (simpleHelper.checkSimpleChecksum(buffer, bufferPosition-2)) {
+                // The payload is everything before the checksum and CR
+                uint8_t payloadLength = frame->length - 2;
+                uint16_t payloadSum = frame->sum - 13 - (uint8_t) frame->data[payloadLength];
+
+                if (simpleHelper.isReplyLength(payloadLength) &&
+                        simpleHelper.checkSimpleChecksum(payloadSum, frame->data[payloadLength])) {
                     Log.info("SIMPLE: Checksum valid");
-                    buffer[bufferPosition-2] = '\0'; // Overwrite the checksum
-                    memcpy(message, buffer, bufferPosition-1);
+                    frame->length -= 2;
+                    frame->data[frame->length] = '\0'; // Overwrite the checksum
                     messageReady = true;
-                    messageLength = bufferPosition-2;
                 } else {
-                    buffer[bufferPosition++] = incomingByte;
+                    frame->data[frame->length++] = incomingByte;
+                    frame->sum += incomingByte;
                 }
             } else {
-                buffer[bufferPosition-1] = '\0'; // Replace 13 with termination
-                memcpy(message, buffer, bufferPosition);
+                frame->length -= 1;
+                frame->data[frame->length] = '\0'; // Replace 13 with termination
                 messageReady = true;
-                messageLength = bufferPosition-1;
             }
 
             if (messageReady) {
-                bufferPosition = 0;
                 screenRequestRetryCount = 0;
                 break;
             }
 
         } else {
-            buffer[bufferPosition++] = incomingByte;
+            frame->data[frame->length++] = incomingByte;
+            frame->sum += incomingByte;
         }
     } // while (texSerial.available() > 0)
 
-    if (bufferPosition > 0 && millis() > (messageStart+50)) {
-        Log.info("Message failed to receive within 50ms");
-        memcpy(message, buffer, bufferPosition);
-        message[bufferPosition] = '\0';
+    if (!messageReady && frame->length > 0 &&
+            (micros() - lastByteMicros) > getFrameGapTimeout()) {
+        Log.info("Message timed out after %luus gap", micros() - lastByteMicros);
+        frame->data[frame->length] = '\0';
+        frame->complete = false;
         messageReady = true;
-        messageLength = bufferPosition;
-        messageComplete = false;
-        bufferPosition = 0;
+        lastFrameTimedOut = true;
+        serialStats.timeoutFrames++;
     }
 
-    if (messageReady) {
-        Log.info(message);
+    if (!messageReady)
+        return NULL;
 
-        bool processedSuccessfully = false;
-        if (activeProtocol == SIMPLE || taskStep == SIMPLE_LOGIN) {
-            processedSuccessfully = processSimpleMessage(message, messageLength);
-        } else if (activeProtocol == CRESTRON) {
-            processedSuccessfully = processCrestronMessage(message, messageLength);
-        }
+    // Every byte still queued behind the terminator arrived after it,
+    // so the frame has been waiting at least that many byte times
+    frame->receivedMicros = micros() - (texSerial.available() * texSerialByteMicros);
 
-        if (!processedSuccessfully) {
-            if (message[0] == '"') {
-                Log.info(String::format("Unknown Crestron command - %s", message));
-            } else {
-                Log.info("Unknown non-Crestron command - %s", message);
-                for (uint8_t i = 0; i < messageLength; i++) {
-                    Log.info("%d\n", message[i]);
-                }
+    // Hand this slot out as-is and assemble the next frame in the following one
+    frameSlot = (frameSlot + 1) % framePoolSize;
+    framePool[frameSlot].length = 0;
+    framePool[frameSlot].sum = 0;
+
+    return frame;
+}
+
+void TexecomClass::updateByteGap(uint32_t gap) {
+    // Gaps are measured when bytes are polled so are an upper bound.
+    // Anything beyond the ceiling is a new frame or a stalled loop.
+    if (gap > frameGapMaxTimeout)
+        return;
+
+    int32_t error = (int32_t)gap - byteGapAverage;
+    byteGapAverage += error / 8;
+    byteGapDeviation += (abs(error) - byteGapDeviation) / 4;
+}
+
+uint32_t TexecomClass::getFrameGapTimeout() {
+    uint32_t timeout = frameGapTimeoutOverride;
+
+    if (timeout == 0) {
+        timeout = byteGapAverage + (4 * byteGapDeviation);
+
+        if (timeout < frameGapMinBytes * texSerialByteMicros)
+            timeout = frameGapMinBytes * texSerialByteMicros;
+        else if (timeout > frameGapMaxTimeout)
+            timeout = frameGapMaxTimeout;
+    }
+
+    serialStats.frameGapTimeout = timeout;
+    return timeout;
+}
+
+void TexecomClass::processFrame(FRAME *frame) {
+    char *message = frame->data;
+    uint8_t messageLength = frame->length;
+
+    uint32_t queueDelay = micros() - frame->receivedMicros;
+    lastFrameTime = millis();
+    serialStats.frameCount++;
+
+    if (!isLinkUp())
+        setLinkUp();
+    serialStats.frameQueueDelayTotal += queueDelay;
+    if (queueDelay > serialStats.frameQueueDelayMax)
+        serialStats.frameQueueDelayMax = queueDelay;
+
+    Recorder.record(SerialRecorder::RECORD_RX,
+                    (activeProtocol == SIMPLE || taskStep == SIMPLE_LOGIN) ?
+                        SerialRecorder::RECORD_SIMPLE : SerialRecorder::RECORD_CRESTRON,
+                    message, messageLength, frame->receivedMicros);
+
+    Log.info(message);
+
+    bool processedSuccessfully = false;
+    if (activeProtocol == SIMPLE || taskStep == SIMPLE_LOGIN) {
+        processedSuccessfully = processSimpleMessage(message, messageLength);
+    } else if (activeProtocol == CRESTRON) {
+        processedSuccessfully = processCrestronMessage(message, messageLength, frame->receivedMicros);
+    }
+
+    if (!processedSuccessfully) {
+        if (message[0] == '"') {
+            Log.info(String::format("Unknown Crestron command - %s", message));
+        } else {
+            Log.info("Unknown non-Crestron command - %s", message);
+            for (uint8_t i = 0; i < messageLength; i++) {
+                Log.info("%d\n", message[i]);
             }
+        }
 
-            if (crestronTask != CRESTRON_IDLE && !messageComplete) {
-                if (screenRequestRetryCount++ < 3) {
-                    if (taskStep == CRESTRON_CONFIRM_ARMED || taskStep == CRESTRON_CONFIRM_DISARMED) {
-                        Log.info("Retrying arm state request");
-                        crestronHelper.requestArmState();
-                    } else if (taskStep == CRESTRON_CONFIRM_IDLE_SCREEN ||
-                                taskStep == CRESTRON_WAIT_FOR_ARM_PROMPT ||
-                                taskStep == CRESTRON_WAIT_FOR_DISARM_PROMPT ||
-                                taskStep == CRESTRON_WAIT_FOR_PART_ARM_PROMPT ||
-                                taskStep == CRESTRON_WAIT_FOR_NIGHT_ARM_PROMPT) {
-                        Log.info("Retrying screen request");
-                        crestronHelper.requestScreen();
-                    } else {
-                        Log.info("Retry count exceeded");
-                    }
+        if (crestronTask != CRESTRON_IDLE && !frame->complete) {
+            if (screenRequestRetryCount++ < 3) {
+                if (taskStep == CRESTRON_CONFIRM_ARMED || taskStep == CRESTRON_CONFIRM_DISARMED) {
+                    Log.info("Retrying arm state request");
+                    serialStats.timeoutRetries++;
+                    crestronHelper.requestArmState();
+                } else if (taskStep == CRESTRON_CONFIRM_IDLE_SCREEN ||
+                            taskStep == CRESTRON_WAIT_FOR_ARM_PROMPT ||
+                            taskStep == CRESTRON_WAIT_FOR_DISARM_PROMPT ||
+                            taskStep == CRESTRON_WAIT_FOR_PART_ARM_PROMPT ||
+                            taskStep == CRESTRON_WAIT_FOR_NIGHT_ARM_PROMPT) {
+                    Log.info("Retrying screen request");
+                    serialStats.timeoutRetries++;
+                    crestronHelper.requestScreen();
+                } else {
+                    Log.info("Retry count exceeded");
                 }
-            } else {
-                processTask(UNKNOWN_MESSAGE);
             }
+        } else {
+            processTask(UNKNOWN_MESSAGE);
         }
     }
+}
 
-    // HANDLE CRESTON LOGIN VIA KEYPRESS ON VIRTUAL SCREEN
-    if (taskStep == CRESTRON_LOGIN && millis() > nextPinEntryTime) {
-        texSerial.print("KEY");
-        texSerial.println(userPin[loginPinPosition++]);
-
-        if (loginPinPosition >= strlen(userPin)) {
-            loginPinPosition = 0;
-            nextPinEntryTime = 0;
-            processTask(CRESTRON_LOGIN_COMPLETE);
-        } else {
-            nextPinEntryTime = millis() + PIN_ENTRY_DELAY;
-        }
+void TexecomClass::loop() {
+    FRAME *frame;
+    uint8_t framesThisLoop = 0;
+
+    // Dispatch every complete frame waiting in the RX ring rather than
+    // one per loop. Bounded so a flood can't starve the rest of the loop
+    while (framesThisLoop < maxFramesPerLoop &&
+            (frame = readFrame()) != NULL) {
+        processFrame(frame);
+        framesThisLoop++;
     }
 
+    if (framesThisLoop > serialStats.maxFramesPerLoop)
+        serialStats.maxFramesPerLoop = framesThisLoop;
+
+    jobQueue.expire(millis());
+    runNextJob();
+
     /*
     if (crestronTask == CRESTRON_IDLE && alarmState == ARMING &&
         millis() > (lastStateChange + armingTimeout)) {
@@ -964,16 +1638,45 @@ void TexecomClass::loop() {
     }
     */
 
-    // USED TO EXECUTE DELAYED COMMANDS
-    if (delayedCommandExecuteTime > 0 &&
-        millis() > delayedCommandExecuteTime) {
-        crestronHelper.request(delayedCommand);
-        delayedCommandExecuteTime = 0;
+    // SEND QUEUED KEYPRESSES AND STATUS REQUESTS
+    if (activeProtocol == CRESTRON)
+        crestronHelper.loop();
+
+
+    // A STATUS REQUEST WENT UNANSWERED THROUGH EVERY RETRY
+    CrestronHelper::CRESTRON_COMMAND failedCommand;
+    if (crestronHelper.takeFailure(&failedCommand)) {
+        Log.info("Crestron request %d unanswered after %d retries", failedCommand, maxRetries);
+        if (failedCommand == CrestronHelper::COMMAND_ARMED_STATE)
+            setLinkDown();
+        else
+            lastFrameTime = 0;  // Probe the link now
+        if (crestronTask != CRESTRON_IDLE)
+            processTask(CRESTRON_TASK_TIMEOUT);
     }
 
+    // THERE IS NO NOTIFICATION IF AN INCORRECT USER CODE IS ENTERED. BESIDES
+    // WATCHING THE SCREEN, GIVE UP ONCE THE LOGIN IS LATER THAN USUAL
+    if (crestronTask != CRESTRON_IDLE &&
+            taskStep == CRESTRON_LOGIN_WAIT &&
+            crestronHelper.queuedCommands() == 0 &&
+            millis() - crestronHelper.lastKeyTime() > loginEstimate.timeout) {
+        Log.info("No login within %lums of the last digit", loginEstimate.timeout);
+        abortCrestronTask("Incorrect user code");
+    }
 
-    // THERE IS NO NOTIFICATION IF AN INCORRECT USER CODE IS ENTERED
-    // WE HAVE TO RELY ON A TIMEOUT
+    // THE FINAL KEY PRESS IS ANSWERED BY A STATE EVENT, SO ALLOW THE
+    // LEARNED ARM OR DISARM RESPONSE TIME ONCE ALL KEYS ARE SENT
+    if (crestronTask != CRESTRON_IDLE &&
+            (taskStep == CRESTRON_ARM_REQUESTED ||
+            taskStep == CRESTRON_DISARM_REQUESTED) &&
+            crestronHelper.queuedCommands() == 0) {
+        uint32_t timeout = taskStep == CRESTRON_ARM_REQUESTED ? armEstimate.timeout : disarmEstimate.timeout;
+        if (millis() - crestronHelper.lastKeyTime() > timeout) {
+            Log.info("No response to key press within %lums", timeout);
+            processTask(CRESTRON_TASK_TIMEOUT);
+        }
+    }
 
     // DETECT AN ARMING FAILURE VIA A TIMEOUT
     if (armStartTime != 0 &&
@@ -989,18 +1692,22 @@ void TexecomClass::loop() {
     // SWITCH TO SIMPLE PROTOCOL BY SENDING
     // THE UDL CODE AS \W1234/ TWICE
     if (simpleTask != SIMPLE_IDLE && taskStep == SIMPLE_LOGIN && millis() > (simpleCommandLastSent+500)) {
-        // TODO: This needs to error if there are too many login attempts
-        Log.info("SIMPLE: Performing simple login");
-        simpleCommandLastSent = millis();
-
-        char loginData[9];
-        loginData[0] = '\\';
-        loginData[1] = 'W';
-        for (int i = 0; i < 6; i++)
-            loginData[2+i] = savedData.udlCode[i];
-        loginData[8] = '/';
-
-        simpleHelper.sendSimpleMessage(loginData, 9);
+        if (simpleLoginAttempts >= maxSimpleLoginAttempts) {
+            abandonSimpleLogin();
+        } else {
+            Log.info("SIMPLE: Performing simple login");
+            simpleCommandLastSent = millis();
+            simpleLoginAttempts++;
+
+            char loginData[9];
+            loginData[0] = '\\';
+            loginData[1] = 'W';
+            for (int i = 0; i < 6; i++)
+                loginData[2+i] = savedData.udlCode[i];
+            loginData[8] = '/';
+
+            simpleHelper.sendSimpleMessage(loginData, 9);
+        }
     }
 
     // Auto-logout of the Simple Protocol. Should never be required.
@@ -1013,14 +1720,16 @@ void TexecomClass::loop() {
         } else {
             activeProtocol = CRESTRON;
             simpleTask = SIMPLE_IDLE;
-            Alarm.completeTriggeredAlarm();
+            simpleOperations = 0;
             Log.info("SIMPLE: Simple logout failed and was forced");
         }
     }
 
+    checkLink();
     checkDigiOutputs();
     Alarm.loop();
+    Recorder.loop();
 }
 
 // make one instance for the user to use
-TexecomClass Texecom = TexecomClass();
\ No newline at end of file
+TexecomClass Texecom;
\ No newline at end of file
@@ -5,12 +5,32 @@
 
 #include "Particle.h"
 #include "crestonhelper.h"
+#include "crestronmatcher.h"
+#include "digioutputs.h"
+#include "jobqueue.h"
 #include "simplehelper.h"
+#include "zonemap.h"
+#include "zonestore.h"
 
 #define texSerial Serial1
+#define texSerialBaudRate 19200
+#define texSerialBitsPerByte 11 // 1 start, 8 data, 2 stop (SERIAL_8N2)
+#define texSerialByteMicros ((1000000UL * texSerialBitsPerByte) / texSerialBaudRate)
+#define texSerialRxBufferSize 256
+#define texSerialTxBufferSize 128
 
-#define firstZone 9 // Zone 1 = 1
-#define zoneCount 11 // 1 == 1
+#define framePoolSize 4 // Received frames held before their slot is reused
+#define maxMessageSize 100
+
+#define noDigiState 0xFF // No state output is active
+
+#define screenConfigAddress 64 // EEPROM, clear of SAVE_DATA
+#define zoneConfigAddress 512 // EEPROM, clear of the screen config
+
+#define defaultFirstZone 9 // Zone 1 = 1
+#define defaultZoneCount 11 // 1 == 1
+// A \Z reply, two bytes per zone plus checksum and CR, fits in a frame
+#define maxZonesPerRead ((maxMessageSize - 3) / 2)
 
 class TexecomClass {
  public:
@@ -20,6 +40,77 @@ class TexecomClass {
         char udlCode[7];
     };
 
+    struct FRAME {
+        char data[maxMessageSize+1];
+        uint8_t length;
+        uint16_t sum;           // Of every byte in data, for Simple checksums
+        bool complete;
+        uint32_t receivedMicros;
+    };
+
+    struct SERIAL_STATS {
+        uint32_t frameCount;
+        uint64_t frameQueueDelayTotal;  // microseconds
+        uint32_t frameQueueDelayMax;    // microseconds
+        uint8_t maxFramesPerLoop;
+        uint32_t timeoutFrames;     // Frames ended by the inter-byte timeout
+        uint32_t timeoutRetries;    // Requests resent because of a timed out frame
+        uint32_t frameGapTimeout;   // microseconds
+        uint32_t heartbeats;        // ASTATUS sent because the link was quiet
+        uint32_t linkDowns;
+    };
+
+    typedef enum {
+        SOURCE_NONE = 0,
+        SOURCE_DIGI_OUTPUT = 1,
+        SOURCE_CRESTRON = 2,
+    } STATE_SOURCE;
+
+    struct STATE_STATS {
+        STATE_SOURCE lastSource;    // Source that reported the current state first
+        uint8_t lastArea;
+        uint16_t lastUser;          // User or zone carried by the last Crestron event
+        uint32_t lastLatency;       // microseconds from detection to alarmCallback
+        uint32_t lastLead;          // microseconds before the other source agreed
+        uint32_t digiOutputFirst;
+        uint32_t crestronFirst;
+    };
+
+    typedef enum {
+        TRIGGER_NONE = 0,
+        TRIGGER_RECENT_ZONE = 1,    // Last zone to go active before the alarm
+        TRIGGER_INTRUDER_EVENT = 2, // Zone given by the Crestron intruder event
+        TRIGGER_ZONE_SYNC = 3,      // Alarmed zone read by the Simple sync
+    } TRIGGER_SOURCE;
+
+    struct ZONE_EVENT {
+        uint16_t zone;      // Panel zone number
+        uint32_t time;
+    };
+
+    struct CACHE_STATS {
+        uint32_t hits;      // Confirmation steps answered from the cache
+        uint32_t misses;
+    };
+
+    struct ZONE_STATS {
+        uint32_t reads;         // Simple zone reads
+        uint32_t zonesRead;     // Zones covered by them
+        uint32_t published;     // Zones published after a read
+        uint32_t suppressed;    // Zones read back unchanged
+        uint16_t active;        // Zones currently active
+        uint16_t tampered;
+    };
+
+    struct TASK_STATS {
+        uint32_t lastArmLatency;    // milliseconds from request to arming
+        uint32_t lastDisarmLatency; // milliseconds from request to disarmed
+        uint32_t armCount;
+        uint32_t disarmCount;
+        uint32_t simpleSessions;    // Simple protocol logins
+        uint32_t simpleOperations;  // Operations run within them
+    };
+
     typedef enum {
         ZONE_ACTIVE = 1 << 0,
         ZONE_TAMPER = 1 << 1,
@@ -28,13 +119,14 @@ class TexecomClass {
         ZONE_ALARMED = 1 << 4,
         ZONE_MANUAL_BYPASS = 1 << 5,
         ZONE_AUTO_BYPASS = 1 << 6,
-        ZONE_ALWAYS_ZERO = 1 << 7,
+        ZONE_EXTENDED = 1 << 7,     // Second status byte is non-zero
     } ZONE_FLAGS;
 
     typedef enum {
         ALARM_READY = 1 << 0,
         ALARM_FAULT = 1 << 1,
         ALARM_ARM_FAILED = 1 << 2,
+        ALARM_LINK_DOWN = 1 << 3,   // Serial link lost, state from the digi outputs only
     } ALARM_FLAGS;
 
     typedef enum {
@@ -78,6 +170,7 @@ class TexecomClass {
         CRESTRON_SCREEN_FULL_ARMED,
         CRESTRON_SCREEN_AREA_ENTRY,
         CRESTRON_SCREEN_AREA_EXIT,
+        CRESTRON_SCREEN_INVALID_CODE,
         CRESTRON_LOGIN_COMPLETE,
         CRESTRON_LOGIN_CONFIRMED,
         CRESTRON_FULL_ARM_PROMPT,
@@ -94,6 +187,11 @@ class TexecomClass {
         SIMPLE_TIME_CHECK_OUT
     } TASK_STEP_RESULT;
 
+    struct CACHED_RESULT {
+        TASK_STEP_RESULT result;
+        uint32_t time;  // millis, 0 = unknown
+    };
+
     typedef enum {
         CRESTRON_IDLE = 0,
         CRESTRON_DISARM = 1,
@@ -105,8 +203,14 @@ class TexecomClass {
         SIMPLE_CHECK_TIME = 1,
         SIMPLE_SET_TIME = 2,
         SIMPLE_ZONE_CHECK = 3,
+        SIMPLE_SESSION = 4,     // Logging in, out or between operations
     } SIMPLE_TASK;
 
+    typedef enum {
+        SIMPLE_OP_ZONES = 1 << 0,
+        SIMPLE_OP_TIME = 1 << 1,
+    } SIMPLE_OPERATION;
+
     typedef enum {
         FULL_ARM = 0,
         NIGHT_ARM = 1
@@ -119,33 +223,49 @@ class TexecomClass {
 
  public:
     TexecomClass();
-    void setZoneCallback(void (*zoneCallback)(uint8_t, uint8_t));
+    void setZoneCallback(void (*zoneCallback)(uint16_t, uint8_t));
     void setAlarmCallback(void (*alarmCallback)(TexecomClass::ALARM_STATE, uint8_t));
+    void setFailureCallback(void (*failureCallback)(TexecomClass::CRESTRON_TASK, const char *));
+    void setTriggerCallback(void (*triggerCallback)(uint16_t, TexecomClass::TRIGGER_SOURCE));
     SimpleHelper simpleHelper;
     CrestronHelper crestronHelper;
     void setup();
     void loop();
     void setDebug(bool enabled);
-    bool isReady() { return statePinAreaReady == LOW; }
+    void setFrameGapTimeout(uint32_t timeout);
+    bool isReady() { return digiOutputs.getLevel(DigiOutputs::OUTPUT_AREA_READY) == LOW; }
+    bool isLinkUp() { return !(alarmStateFlags & ALARM_LINK_DOWN); }
+    uint16_t getBlockingZones(uint16_t *zones, uint8_t *states, uint16_t maxZones);
     ALARM_STATE getState() { return alarmState; }
     void updateAlarmState();
+    const JobQueue::JOB_STATS& getJobStats() { return jobQueue.getStats(); }
+    const SERIAL_STATS& getSerialStats() { return serialStats; }
+    const STATE_STATS& getStateStats() { return stateStats; }
+    const TASK_STATS& getTaskStats() { return taskStats; }
+    const CACHE_STATS& getCacheStats() { return cacheStats; }
+    const DigiOutputs::DIGI_STATS& getDigiStats() { return digiOutputs.getStats(); }
+    bool setOutputDebounce(uint8_t output, uint32_t debounce);
+    const ZONE_STATS& getZoneStats();
+    void setCacheMaxAge(uint32_t maxAge);
+    void setFastPath(bool enabled);
     void sendTest(const  char *text);
     void setUDLCode(const char *code);
+    bool setScreenText(const char *name, const char *text);
+    void resetScreenTexts();
+    bool setZoneRanges(const char *ranges);
 
     void requestTimeSync();
     static void startTimeSync();
     void syncTime();
 
-    void requestZoneSync();
+    void requestZoneSync(bool fullSync = false);
     static void startZoneSync();
     void syncZones();
     
     void requestDisarm(const char *code);
-    static void startDisarm();
     void disarm();
 
     void requestArm(const char *code, ARM_TYPE type);
-    static void startArm();
     void arm();
 
 
@@ -153,60 +273,74 @@ class TexecomClass {
     void processTask(TASK_STEP_RESULT result);
     void armSystem(TASK_STEP_RESULT result);
     void disarmSystem(TASK_STEP_RESULT result);
+    void startSimpleSession(uint8_t operations);
+    uint8_t takeSimpleJobs();
+    void nextSimpleOperation();
+    void endSimpleSession(TASK_STEP_RESULT result);
+    void abandonSimpleLogin();
     void simpleLogin(TASK_STEP_RESULT result);
     void checkTime(TASK_STEP_RESULT result);
     void zoneCheck(TASK_STEP_RESULT result);
-    void abortCrestronTask();
-    void (*zoneCallback)(uint8_t, uint8_t);
+    bool hasSuspectZones();
+    void requestZoneRead();
+    void configureZones();
+    void processZoneData(const char *message, uint8_t messageLength);
+    void abortCrestronTask(const char *reason);
+    void startLoginWait();
+    bool isLoginRejected(TASK_STEP_RESULT result);
+    void runNextJob();
+    void startConfirmation();
+    void confirmArmState();
+    void confirmScreen();
+    void cacheResult(TASK_STEP_RESULT result);
+    bool isCacheFresh(const CACHED_RESULT &entry, uint32_t validAfter);
+    TASK_STEP_RESULT getCachedResult(const CACHED_RESULT &entry, uint32_t validAfter);
+    void waitForScreen(TASK_STEP step);
+    bool retryScreenWait();
+    bool isScreenResult(TASK_STEP_RESULT result);
+    void (*zoneCallback)(uint16_t, uint8_t);
     void (*alarmCallback)(TexecomClass::ALARM_STATE, uint8_t);
-    void delayCommand(CrestronHelper::CRESTRON_COMMAND command, int delay);
+    void (*failureCallback)(TexecomClass::CRESTRON_TASK, const char *);
+    void (*triggerCallback)(uint16_t, TexecomClass::TRIGGER_SOURCE);
+    void enterUserPin();
+    static void userPinEntered();
     void decodeZoneState(char *message);
-    void updateZoneState(uint8_t zone);
+    void updateZoneState(uint16_t index);
+    void attributeTrigger(uint16_t zone, TRIGGER_SOURCE source);
+    uint16_t findRecentZone();
+    void confirmTrigger();
     void checkDigiOutputs();
-    bool processCrestronMessage(char *message, uint8_t messageLength);
+    void checkLink();
+    void setLinkDown();
+    void setLinkUp();
+    bool rejectWithoutLink(CRESTRON_TASK task);
+    bool setAlarmState(ALARM_STATE state, STATE_SOURCE source, uint32_t detectedMicros);
+    void decodeAreaEvent(CrestronMatcher::MESSAGE_TYPE type, char *message, uint32_t receivedMicros);
+    bool processCrestronMessage(char *message, uint8_t messageLength, uint32_t receivedMicros);
     bool processSimpleMessage(char *message, uint8_t messageLength);
-
-    const char *msgZoneUpdate = "\"Z0";
-    const char *msgArmUpdate = "\"A0";
-    const char *msgDisarmUpdate = "\"D0";
-    const char *msgEntryUpdate = "\"E0";
-    const char *msgArmingUpdate = "\"X0";
-    const char *msgIntruderUpdate = "\"L0";
-
-    const char *msgUserPinLogin = "\"U0";
-    const char *msgUserTagLogin = "\"T0";
-
-    const char *msgReplyDisarmed = "\"N";
-    const char *msgReplyArmed = "\"Y";
-    const char *msgWelcomeBack = "\"  Welcome Back";
-    const char *msgScreenIdle = "\"  The Cooper's";
-    const char *msgScreenIdlePartArmed = "\" * PART ARMED *";
-
-    const char *msgScreenArmedPart = "\"Part";
-    const char *msgScreenArmedNight = "\"Night";
-    const char *msgScreenArmedFull = "\"Area FULL ARMED";
-
-    const char *msgScreenQuestionArm = "\"Do you want to  Arm System?";
-    const char *msgScreenQuestionPartArm = "\"Do you want to  Part Arm System?";
-    const char *msgScreenQuestionNightArm = "\"Do you want:-   Night Arm";
-    const char *msgScreenQuestionDisarm = "\"Do you want to  Disarm System?";
-
-    const char *msgScreenAreainEntry = "\"Area in Entry";
-    const char *msgScreenAreainExit = "\"Area in Exit >";
+    FRAME* readFrame();
+    void processFrame(FRAME *frame);
+    void updateByteGap(uint32_t gap);
+    uint32_t getFrameGapTimeout();
 
     static const uint8_t userCount = 4;
     const char *users[userCount] = {"root", "Kevin", "Nicki", "Mumma"};
 
+    // Panel operations wait here until the running task has finished
+    JobQueue jobQueue;
+    static void jobExpired(JobQueue::JOB_TYPE type);
+    const uint32_t disarmJobTimeout = 30000;
+    const uint32_t armJobTimeout = 30000;
+    const uint32_t zoneSyncJobTimeout = 180000;
+    const uint32_t timeSyncJobTimeout = 3600000;
+
     PROTOCOL activeProtocol = CRESTRON;
     CRESTRON_TASK crestronTask = CRESTRON_IDLE;
     SIMPLE_TASK simpleTask = SIMPLE_IDLE;
+    uint8_t simpleOperations = 0;  // SIMPLE_OPERATION still to run this session
     ARM_TYPE armType;
-    CrestronHelper::CRESTRON_COMMAND delayedCommand;
-    uint32_t delayedCommandExecuteTime = 0;
-    const uint8_t maxMessageSize = 100;
-    char message[101];
-    char buffer[101];
-    uint8_t bufferPosition;
+    FRAME framePool[framePoolSize];
+    uint8_t frameSlot = 0;  // Slot currently being assembled
     uint8_t screenRequestRetryCount = 0;
 
     TASK_STEP taskStep = CRESTRON_START;
@@ -217,27 +351,117 @@ class TexecomClass {
     uint32_t armStartTime;
     const unsigned int armTimeout = 15000;  // 15 seconds
 
+    // Bounds for the adaptive reply timeouts kept by crestronHelper
     const int commandWaitTimeout = 2000;
-    uint32_t lastCommandTime = 0;
-    int commandAttempts = 0;
     const uint8_t maxRetries = 3;
 
     char userPin[9];
-    uint8_t loginPinPosition;
-    uint32_t nextPinEntryTime;
     const int PIN_ENTRY_DELAY = 500;
+
+    // Time from the last digit to the login event, learned like the
+    // command round trips. A repeated idle screen inside this window is not
+    // yet taken as a rejected code, so the floor allows for a slow login
+    // even once the estimate has settled on fast ones
+    CrestronHelper::RTT_ESTIMATE loginEstimate;
+    const uint32_t minLoginWindow = commandWaitTimeout / 2;
+    bool loginIdleSeen;
+    bool loginScreenLeft;
+
+    // Time from the final key to the arm or disarm event. Exit route checks
+    // can hold "A0 back for seconds, so these are bounded by the flat task
+    // timeouts rather than commandWaitTimeout
+    CrestronHelper::RTT_ESTIMATE armEstimate;
+    CrestronHelper::RTT_ESTIMATE disarmEstimate;
+    const uint32_t minStateChangeWindow = 1000;
+
+    // Fast path moves on as soon as the panel shows the screen a step is
+    // waiting for, polling for it rather than reading it once after a fixed
+    // delay. The delays then only bound how long a wrong screen is tolerated.
+    bool fastPath = true;
+    uint32_t stepStartTime;
+    const int PROMPT_WAIT_DELAY = 500;
+    const int SCREEN_POLL_INTERVAL = 100;
+    const int FAST_PIN_ENTRY_DELAY = 100;
+    uint32_t taskRequestTime;
+    TASK_STATS taskStats;
+
+    // Last arm state and screen seen, whether polled or pushed. A
+    // confirmation step is skipped when its answer is recent enough.
+    CACHED_RESULT armStateCache;
+    CACHED_RESULT screenCache;
+    uint32_t cacheMaxAge = 1000;
+    CACHE_STATS cacheStats;
     ALARM_STATE alarmState = ARMED_AWAY;
     // uint32_t lastStateChange;
     uint32_t exitToDisarmTimeout = 0;
+
+    // Alarm state is fed by both the digi outputs and Crestron push events.
+    // Whichever reports a change first sets it, the other only confirms.
+    STATE_SOURCE stateSource = SOURCE_NONE;
+    uint32_t stateChangeMicros;
+    bool stateConfirmed = true;
+    bool stateLatencyPending = false;
+    STATE_STATS stateStats;
     const int armingTimeout = 45000;
 
-    uint32_t messageStart;
+    // End of frame is declared once no byte has arrived for longer than the
+    // inter-byte timeout. It adapts to the observed gaps (smoothed mean plus
+    // four deviations) between a floor derived from the baud rate and the
+    // original 50ms, unless a fixed value has been set.
+    uint32_t lastByteMicros;
+    bool lastFrameTimedOut = false;
+    int32_t byteGapAverage = 0;
+    int32_t byteGapDeviation = 0;
+    uint32_t frameGapTimeoutOverride = 0;  // microseconds, 0 = adaptive
+    const uint8_t frameGapMinBytes = 16;
+    const uint32_t frameGapMaxTimeout = 50000;
+    const uint8_t maxFramesPerLoop = 8;
+    SERIAL_STATS serialStats;
+
+    // The link is probed with ASTATUS once it has been quiet for the
+    // heartbeat interval. An ASTATUS unanswered through every retry marks it
+    // down, so loss is noticed within the interval plus the retry timeouts.
+    uint32_t lastFrameTime = 0;
+    const uint32_t heartbeatInterval = 30000;
+    const uint32_t downHeartbeatInterval = 5000;
 
     SAVE_DATA savedData;
+    CrestronMatcher::SCREEN_CONFIG screenConfig;
+    CrestronMatcher crestronMatcher;
     uint32_t simpleProtocolTimeout;
     uint32_t simpleCommandLastSent;
-
-    uint8_t zoneStates[zoneCount];
+    uint8_t simpleLoginAttempts;
+    uint32_t simpleLoginFrameCount;     // serialStats.frameCount as the login began
+    const uint8_t maxSimpleLoginAttempts = 6;
+
+    // Zone state is kept per configured zone, by ZoneMap index, and sized
+    // when the zone ranges are configured
+    ZoneMap::ZONE_CONFIG zoneConfig;
+    ZoneMap zoneMap;
+    ZoneStore zoneStore;
+
+    // A zone sync only reads the zones that may be out of date: those
+    // changed by Crestron events since they were last read, those never
+    // published and, every zoneStaleAge, all of them. Only zones whose state
+    // differs from zoneStore are published.
+    uint32_t *suspectZones = NULL;
+    uint32_t *publishedZones = NULL;    // Published at least once since boot
+    uint32_t lastStaleSweep = 0;
+    const uint32_t zoneStaleAge = 900000;  // 15 minutes
+    ZoneMap::ZONE_READ zoneRead;        // Outstanding \Z request
+    uint16_t zoneReadCursor;            // Next index to read from
+    ZONE_STATS zoneStats;
+
+    // The zone behind an alarm is published as soon as the trigger is seen,
+    // from the intruder event or the zones that went active just before it,
+    // and then confirmed against the alarmed zones the sync reads
+    static const uint8_t recentZoneCount = 8;
+    ZONE_EVENT recentZones[recentZoneCount];
+    uint8_t recentZoneSlot = 0;
+    const uint32_t recentZoneWindow = 60000;
+    uint16_t triggerZone = 0;
+    TRIGGER_SOURCE triggerSource = TRIGGER_NONE;
+    bool triggerSeen = false;
     uint8_t alarmStateFlags;
 
 //  Digi Output - Argon Pin - Texecom Configuration
@@ -250,23 +474,22 @@ class TexecomClass {
 //  7 ----------------- D15 - 66 Fault Present
 //  8 ----------------- D19 - 16 Area Ready
 
-    const int pinFullArmed = D12;
-    const int pinPartArmed = D16;
-    const int pinExit = D13;
-    const int pinEntry = D17;
-    const int pinTriggered = D14;
-    const int pinArmFailed = D18;
-    const int pinFaultPresent = D15;
-    const int pinAreaReady = D19;
-
-    bool statePinFullArmed = HIGH;
-    bool statePinPartArmed = HIGH;
-    bool statePinEntry = HIGH;
-    bool statePinExit = HIGH;
-    bool statePinTriggered = HIGH;
-    bool statePinArmFailed = HIGH;
-    bool statePinFaultPresent = HIGH;
-    bool statePinAreaReady = LOW;
+    // In DigiOutputs::OUTPUT order, with the level each starts at
+    const uint16_t digiOutputPins[DigiOutputs::OUTPUT_COUNT] = {
+        D12, D16, D13, D17, D14, D18, D15, D19
+    };
+    const bool digiOutputLevels[DigiOutputs::OUTPUT_COUNT] = {
+        HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, LOW
+    };
+    DigiOutputs digiOutputs;
+
+    // Outputs are active low. Bit n is set while output n is active.
+    static const uint8_t stateOutputs = (1 << DigiOutputs::OUTPUT_FULL_ARMED) |
+                                        (1 << DigiOutputs::OUTPUT_PART_ARMED) |
+                                        (1 << DigiOutputs::OUTPUT_EXIT) |
+                                        (1 << DigiOutputs::OUTPUT_ENTRY) |
+                                        (1 << DigiOutputs::OUTPUT_TRIGGERED);
+    uint8_t lastActiveOutputs = 1 << DigiOutputs::OUTPUT_AREA_READY;
 };
 
 extern TexecomClass Texecom;  // make an instance for the user
@@ -7,12 +7,15 @@
 #include "secrets.h"
 #include "TimeAlarms.h"
 #include "DiagnosticsHelperRK.h"
+#include "serialrecorder.h"
 
 // Stubs
 void mqttCallback(char* topic, byte* payload, unsigned int length);
-void sendTriggeredMessage(uint8_t triggeredZone);
+void triggerCallback(uint16_t zone, TexecomClass::TRIGGER_SOURCE source);
 void alarmCallback(TexecomClass::ALARM_STATE state, uint8_t flags);
-void zoneCallback(uint8_t zone, uint8_t state);
+void failureCallback(TexecomClass::CRESTRON_TASK task, const char *reason);
+void publishNotReady();
+void zoneCallback(uint16_t zone, uint8_t state);
 void publishAlarmState(TexecomClass::ALARM_STATE newState);
 void updateZoneState(uint8_t zone, uint8_t state);
 
@@ -61,21 +64,76 @@ void alarmCallback(TexecomClass::ALARM_STATE state, uint8_t flags) {
         Log.info("Alarm: %s", alarmStateStrings[state]);
     }
 
-    char message[58];
+    char message[80];
 
     snprintf(message,
                 sizeof(message),
-                "{\"state\":\"%s\",\"ready\":%d,\"fault\":%d,\"arm_failed\":%d}",
+                "{\"state\":\"%s\",\"ready\":%d,\"fault\":%d,\"arm_failed\":%d,\"degraded\":%d}",
                 alarmStateStrings[state],
                 (flags & TexecomClass::ALARM_READY) != 0,
                 (flags & TexecomClass::ALARM_FAULT) != 0,
-                (flags & TexecomClass::ALARM_ARM_FAILED) != 0);
+                (flags & TexecomClass::ALARM_ARM_FAILED) != 0,
+                (flags & TexecomClass::ALARM_LINK_DOWN) != 0);
 
 
     mqttClient.publish("home/security/alarm", message, true);
 }
 
-void zoneCallback(uint8_t zone, uint8_t state) {
+// Names the zones stopping the arm, from the zone state already held
+void publishNotReady() {
+    const uint8_t maxListed = 10;  // Keeps the message within one MQTT packet
+    uint16_t zones[maxListed];
+    uint8_t states[maxListed];
+    uint16_t blocking = Texecom.getBlockingZones(zones, states, maxListed);
+    uint8_t listed = min(blocking, (uint16_t) maxListed);
+
+    char message[192];
+    int length = snprintf(message, sizeof(message), "Arm attempted while alarm is not ready");
+
+    for (uint8_t i = 0; i < listed && length < (int) sizeof(message); i++) {
+        length += snprintf(message + length, sizeof(message) - length,
+                            "%s %03d %s",
+                            i == 0 ? ", blocked by zone" : ",",
+                            zones[i],
+                            (states[i] & TexecomClass::ZONE_TAMPER) ? "tamper" : "active");
+    }
+
+    if (blocking > listed && length < (int) sizeof(message))
+        snprintf(message + length, sizeof(message) - length, " and %d more", blocking - listed);
+
+    Log.error(message);
+    mqttClient.publish("home/notification/low", message);
+}
+
+void failureCallback(TexecomClass::CRESTRON_TASK task, const char *reason) {
+    char message[64];
+
+    snprintf(message,
+                sizeof(message),
+                "%s failed: %s",
+                task == TexecomClass::CRESTRON_ARM ? "Arm" : "Disarm",
+                reason);
+
+    Log.error(message);
+    mqttClient.publish("home/notification/low", message);
+}
+
+// Published once the alarm is put down to a zone, and again if a better
+// source names a different one
+void triggerCallback(uint16_t zone, TexecomClass::TRIGGER_SOURCE source) {
+    static const char *sourceStrings[] = {"none", "recent", "intruder", "sync"};
+    char message[48];
+
+    snprintf(message,
+                sizeof(message),
+                "{\"zone\":%d,\"source\":\"%s\"}",
+                zone,
+                sourceStrings[source]);
+
+    mqttClient.publish("home/security/alarm/triggered", message, true);
+}
+
+void zoneCallback(uint16_t zone, uint8_t state) {
 
     char attributesTopic[34];
     snprintf(attributesTopic, sizeof(attributesTopic), "home/security/zone/%03d", zone);
@@ -116,7 +174,7 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
             if (strcmp(code, "8463") == 0) { // 8463 == TIME
                 Texecom.requestTimeSync();
             } else if (strcmp(code, "7962") == 0) { // 7962 == SYNC
-                Texecom.requestZoneSync();
+                Texecom.requestZoneSync(true);
             } else {
                 if (strncmp(action, "arm", 3) == 0) {
                     if (Texecom.isReady()) {
@@ -129,9 +187,7 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
                             Texecom.requestArm(code, TexecomClass::NIGHT_ARM);
                         }
                     } else {
-                        const char *notReadyMessage = "Arm attempted while alarm is not ready";
-                        Log.error(notReadyMessage);
-                        mqttClient.publish("home/notification/low", notReadyMessage);
+                        publishNotReady();
                     }
                 } else if (strcmp(action, "disarm") == 0) {
                     Texecom.requestDisarm(code);
@@ -180,11 +236,100 @@ int setDebug(const char *data) {
     return 0;
 }
 
+int setFastPath(const char *data) {
+    Texecom.setFastPath(strcmp(data, "false") != 0);
+    return 0;
+}
+
+int setCacheAge(const char *data) {
+    Texecom.setCacheMaxAge(atoi(data));
+    return 0;
+}
+
+int setFrameGap(const char *data) {
+    Texecom.setFrameGapTimeout(atoi(data));
+    return 0;
+}
+
+bool captureDumpActive = false;
+bool captureHeaderSent;
+uint32_t captureDumpPosition;
+
+int setCapture(const char *data) {
+    if (strcmp(data, "dump") == 0) {
+        captureDumpPosition = Recorder.oldestRecord();
+        captureHeaderSent = false;
+        captureDumpActive = true;
+    } else if (strcmp(data, "spill") == 0) {
+        Recorder.setSpillToFlash(true);
+    } else if (strcmp(data, "nospill") == 0) {
+        Recorder.setSpillToFlash(false);
+    } else {
+        Recorder.setEnabled(strcmp(data, "off") != 0);
+    }
+    return 0;
+}
+
+// Publish the capture in chunks, one per loop, starting with the file header
+void sendCaptureChunk() {
+    uint8_t chunk[200];
+    uint16_t length = 0;
+
+    if (!captureHeaderSent) {
+        length = Recorder.getFileHeader(chunk);
+        captureHeaderSent = true;
+    }
+
+    length += Recorder.read(&captureDumpPosition, &chunk[length], sizeof(chunk) - length);
+
+    if (length == 0) {
+        captureDumpActive = false;
+        mqttClient.publish("home/security/alarm/capture", "");
+        return;
+    }
+
+    mqttClient.publish("home/security/alarm/capture", chunk, length);
+}
+
 int setUDL(const char *data) {
     Texecom.setUDLCode(data);
     return 0;
 }
 
+// "name=text" sets one screen text, "name=" disables it, "reset" restores all
+int setScreen(const char *data) {
+    if (strcmp(data, "reset") == 0) {
+        Texecom.resetScreenTexts();
+        return 0;
+    }
+
+    char name[16];
+    const char *text = strchr(data, '=');
+
+    if (text == NULL || (size_t) (text - data) >= sizeof(name))
+        return -1;
+
+    strncpy(name, data, text - data);
+    name[text - data] = '\0';
+
+    return Texecom.setScreenText(name, text + 1) ? 0 : -1;
+}
+
+// "n=us" sets the debounce time of digi output n, 1 to 8
+int setDebounce(const char *data) {
+    const char *value = strchr(data, '=');
+
+    if (value == NULL)
+        return -1;
+
+    return Texecom.setOutputDebounce(atoi(data) - 1, strtoul(value + 1, NULL, 10)) ? 0 : -1;
+}
+
+// "9-19,33-40" sets the zone ranges in use
+int setZones(const char *data) {
+    return Texecom.setZoneRanges(data) ? 0 : -1;
+}
+
 void connectToMQTT() {
     lastMqttConnectAttempt = millis();
     bool mqttConnected = mqttClient.connect(System.deviceID(), mqttUsername, mqttPassword);
@@ -195,6 +340,8 @@ void connectToMQTT() {
         mqttClient.subscribe("home/security/alarm/code");
         mqttClient.subscribe("home/security/alarm/state");
         mqttClient.subscribe("utilities/#");
+        // Zone publishes are skipped while disconnected, so refresh them all
+        Texecom.requestZoneSync(true);
     } else {
         mqttConnectionAttempts++;
         Log.info("MQTT failed to connect");
@@ -206,7 +353,7 @@ void sendTelegrafMetrics() {
     if (millis() > nextMetricsUpdate) {
         nextMetricsUpdate = millis() + 30000;
 
-        char buffer[150];
+        char buffer[256];
         snprintf(buffer, sizeof(buffer),
             "status,device=Texecom uptime=%d,resetReason=%d,firmware=\"%s\",memTotal=%ld,memFree=%ld",
             System.uptime(),
@@ -216,6 +363,103 @@ void sendTelegrafMetrics() {
             DiagnosticsHelper::getValue(DIAG_ID_SYSTEM_USED_RAM)
             );
         mqttClient.publish("telegraf/particle", buffer);
+
+        const TexecomClass::SERIAL_STATS& serialStats = Texecom.getSerialStats();
+        snprintf(buffer, sizeof(buffer),
+            "serial,device=Texecom frames=%lu,queueDelayAvg=%lu,queueDelayMax=%lu,maxFramesPerLoop=%u,"
+            "timeoutFrames=%lu,timeoutRetries=%lu,frameGapTimeout=%lu,heartbeats=%lu,linkDowns=%lu",
+            serialStats.frameCount,
+            serialStats.frameCount ? (uint32_t)(serialStats.frameQueueDelayTotal / serialStats.frameCount) : 0,
+            serialStats.frameQueueDelayMax,
+            serialStats.maxFramesPerLoop,
+            serialStats.timeoutFrames,
+            serialStats.timeoutRetries,
+            serialStats.frameGapTimeout,
+            serialStats.heartbeats,
+            serialStats.linkDowns
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const TexecomClass::STATE_STATS& stateStats = Texecom.getStateStats();
+        snprintf(buffer, sizeof(buffer),
+            "alarmstate,device=Texecom source=%u,latency=%lu,lead=%lu,digiOutputFirst=%lu,crestronFirst=%lu",
+            stateStats.lastSource,
+            stateStats.lastLatency,
+            stateStats.lastLead,
+            stateStats.digiOutputFirst,
+            stateStats.crestronFirst
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const TexecomClass::TASK_STATS& taskStats = Texecom.getTaskStats();
+        snprintf(buffer, sizeof(buffer),
+            "arming,device=Texecom armLatency=%lu,disarmLatency=%lu,armCount=%lu,disarmCount=%lu",
+            taskStats.lastArmLatency,
+            taskStats.lastDisarmLatency,
+            taskStats.armCount,
+            taskStats.disarmCount
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        snprintf(buffer, sizeof(buffer),
+            "simple,device=Texecom sessions=%lu,operations=%lu",
+            taskStats.simpleSessions,
+            taskStats.simpleOperations
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const JobQueue::JOB_STATS& jobStats = Texecom.getJobStats();
+        snprintf(buffer, sizeof(buffer),
+            "jobs,device=Texecom queued=%lu,coalesced=%lu,expired=%lu",
+            jobStats.queued,
+            jobStats.coalesced,
+            jobStats.expired
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const TexecomClass::CACHE_STATS& cacheStats = Texecom.getCacheStats();
+        snprintf(buffer, sizeof(buffer),
+            "cache,device=Texecom hits=%lu,misses=%lu",
+            cacheStats.hits,
+            cacheStats.misses
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const DigiOutputs::DIGI_STATS& digiStats = Texecom.getDigiStats();
+        snprintf(buffer, sizeof(buffer),
+            "digioutputs,device=Texecom edges=%lu,bounces=%lu,overflows=%lu",
+            digiStats.edges,
+            digiStats.bounces,
+            digiStats.overflows
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const TexecomClass::ZONE_STATS& zoneStats = Texecom.getZoneStats();
+        snprintf(buffer, sizeof(buffer),
+            "zones,device=Texecom reads=%lu,zonesRead=%lu,published=%lu,suppressed=%lu,active=%u,tampered=%u",
+            zoneStats.reads,
+            zoneStats.zonesRead,
+            zoneStats.published,
+            zoneStats.suppressed,
+            zoneStats.active,
+            zoneStats.tampered
+            );
+        mqttClient.publish("telegraf/particle", buffer);
+
+        const CrestronHelper::LINK_STATS& linkStats = Texecom.crestronHelper.getStats();
+        snprintf(buffer, sizeof(buffer),
+            "crestron,device=Texecom astatusRtt=%ld,lstatusRtt=%ld,keyRtt=%ld,"
+            "astatusRto=%lu,lstatusRto=%lu,keyRto=%lu,retransmits=%lu,failures=%lu",
+            Texecom.crestronHelper.getEstimate(CrestronHelper::COMMAND_ARMED_STATE).smoothed,
+            Texecom.crestronHelper.getEstimate(CrestronHelper::COMMAND_SCREEN_STATE).smoothed,
+            Texecom.crestronHelper.getEstimate(CrestronHelper::COMMAND_KEY).smoothed,
+            Texecom.crestronHelper.getTimeout(CrestronHelper::COMMAND_ARMED_STATE),
+            Texecom.crestronHelper.getTimeout(CrestronHelper::COMMAND_SCREEN_STATE),
+            Texecom.crestronHelper.getTimeout(CrestronHelper::COMMAND_KEY),
+            linkStats.retransmits,
+            linkStats.failures
+            );
+        mqttClient.publish("telegraf/particle", buffer);
     }
 }
 
@@ -261,6 +505,13 @@ void setup() {
     Particle.function("setDebug", setDebug);
     Particle.function("cloudReset", cloudReset);
     Particle.function("setUDL", setUDL);
+    Particle.function("setFrameGap", setFrameGap);
+    Particle.function("setCapture", setCapture);
+    Particle.function("setScreen", setScreen);
+    Particle.function("setZones", setZones);
+    Particle.function("setDebounce", setDebounce);
+    Particle.function("setFastPath", setFastPath);
+    Particle.function("setCacheAge", setCacheAge);
 
     Particle.variable("isDebug", isDebug);
     Particle.variable("reset-time", resetTime);
@@ -273,7 +524,9 @@ void setup() {
     connectToMQTT();
 
     Texecom.setAlarmCallback(alarmCallback);
+    Texecom.setFailureCallback(failureCallback);
     Texecom.setZoneCallback(zoneCallback);
+    Texecom.setTriggerCallback(triggerCallback);
     Texecom.setup();
 
     uint32_t resetReasonData = System.resetReasonData();
@@ -284,6 +537,8 @@ void loop() {
     if (mqttClient.isConnected()) {
         mqttClient.loop();
         sendTelegrafMetrics();
+        if (captureDumpActive)
+            sendCaptureChunk();
     } else if ((mqttConnectionAttempts < 5 && millis() > (lastMqttConnectAttempt + mqttConnectAtemptTimeout1)) ||
                  millis() > (lastMqttConnectAttempt + mqttConnectAtemptTimeout2)) {
         connectToMQTT();
@@ -0,0 +1,171 @@
+#include "zonemap.h"
+
+ZoneMap::ZoneMap() {}
+
+void ZoneMap::begin(const ZONE_CONFIG *config) {
+    rangeCount = config->rangeCount;
+    zoneTotal = 0;
+
+    for (uint8_t r = 0; r < rangeCount; r++) {
+        ranges[r] = config->ranges[r];
+        rangeIndex[r] = zoneTotal;
+        zoneTotal += ranges[r].count;
+    }
+}
+
+// Returns -1 for zones outside every configured range. A single range
+// costs one subtract and compare.
+int16_t ZoneMap::indexOf(uint16_t zone) {
+    for (uint8_t r = 0; r < rangeCount; r++) {
+        uint16_t offset = zone - ranges[r].first;
+        if (offset < ranges[r].count)
+            return rangeIndex[r] + offset;
+    }
+    return -1;
+}
+
+uint16_t ZoneMap::zoneNumber(uint16_t index) {
+    uint8_t r = rangeCount - 1;
+    while (r > 0 && rangeIndex[r] > index)
+        r--;
+    return ranges[r].first + index - rangeIndex[r];
+}
+
+// Finds the next block of zones to read, starting from the first zone at
+// or after index from that is set in zones. A block stays within one range,
+// so its panel zone numbers are contiguous, spans at most maxCount zones and
+// ends on the last set zone within that.
+bool ZoneMap::nextRead(const uint32_t *zones, uint16_t from, uint8_t maxCount, ZONE_READ *read) {
+    uint16_t start = findNext(zones, from, zoneTotal);
+
+    if (start >= zoneTotal)
+        return false;
+
+    uint8_t r = rangeCount - 1;
+    while (r > 0 && rangeIndex[r] > start)
+        r--;
+
+    uint16_t end = min((uint16_t) (rangeIndex[r] + ranges[r].count), (uint16_t) (start + maxCount));
+    uint16_t last = findLast(zones, start, end);
+
+    read->index = start;
+    read->zone = ranges[r].first + start - rangeIndex[r];
+    read->count = last - start + 1;
+    return true;
+}
+
+void ZoneMap::fill(uint32_t *zones) {
+    uint16_t words = zoneWords();
+
+    for (uint16_t w = 0; w < words; w++)
+        zones[w] = 0xFFFFFFFF;
+    if (zoneTotal % 32)
+        zones[words - 1] = (1UL << (zoneTotal % 32)) - 1;
+}
+
+bool ZoneMap::any(const uint32_t *zones) {
+    for (uint16_t w = 0; w < zoneWords(); w++) {
+        if (zones[w])
+            return true;
+    }
+    return false;
+}
+
+// Index of the first set zone in [from, end), or end if there is none
+uint16_t ZoneMap::findNext(const uint32_t *zones, uint16_t from, uint16_t end) {
+    if (from >= end)
+        return end;
+
+    uint16_t w = from / 32;
+    uint32_t word = zones[w] & (0xFFFFFFFF << (from % 32));
+
+    while (true) {
+        if (word) {
+            uint16_t index = w * 32 + __builtin_ctz(word);
+            return index < end ? index : end;
+        }
+        if (++w * 32 >= end)
+            return end;
+        word = zones[w];
+    }
+}
+
+// Index of the last set zone in [from, end). Zone from must be set.
+uint16_t ZoneMap::findLast(const uint32_t *zones, uint16_t from, uint16_t end) {
+    uint16_t w = (end - 1) / 32;
+    uint32_t word = zones[w];
+
+    if (end % 32)
+        word &= (1UL << (end % 32)) - 1;
+
+    while (!word && w > from / 32)
+        word = zones[--w];
+
+    return word ? w * 32 + 31 - __builtin_clz(word) : from;
+}
+
+void ZoneMap::getDefaultConfig(ZONE_CONFIG *config, uint16_t first, uint16_t count) {
+    memset(config, 0, sizeof(ZONE_CONFIG));
+    config->version = configVersion;
+    config->rangeCount = 1;
+    config->ranges[0].first = first;
+    config->ranges[0].count = count;
+}
+
+// Accepts a comma separated list of zones and zone ranges, "9-19,33-40"
+bool ZoneMap::parseConfig(const char *text, ZONE_CONFIG *config) {
+    memset(config, 0, sizeof(ZONE_CONFIG));
+    config->version = configVersion;
+
+    while (*text) {
+        if (config->rangeCount == maxRanges)
+            return false;
+
+        char *end;
+        uint32_t first = strtoul(text, &end, 10);
+        uint32_t last = first;
+
+        if (end == text)
+            return false;
+        text = end;
+
+        if (*text == '-') {
+            last = strtoul(++text, &end, 10);
+            if (end == text)
+                return false;
+            text = end;
+        }
+
+        if (*text == ',')
+            text++;
+        else if (*text)
+            return false;
+
+        if (last < first || last > maxZone)
+            return false;
+
+        config->ranges[config->rangeCount].first = first;
+        config->ranges[config->rangeCount].count = last - first + 1;
+        config->rangeCount++;
+    }
+
+    return isValid(config);
+}
+
+// Unwritten EEPROM reads back as 0xFF so fails the version check
+bool ZoneMap::isValid(const ZONE_CONFIG *config) {
+    if (config->version != configVersion ||
+            config->rangeCount == 0 ||
+            config->rangeCount > maxRanges)
+        return false;
+
+    uint16_t next = 1;
+    for (uint8_t r = 0; r < config->rangeCount; r++) {
+        const ZONE_RANGE &range = config->ranges[r];
+        if (range.first < next || range.count == 0 ||
+                range.first + range.count - 1 > maxZone)
+            return false;
+        next = range.first + range.count;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+// Copyright 2020 Kevin Cooper
+
+#ifndef __ZONEMAP_H_
+#define __ZONEMAP_H_
+
+#include "Particle.h"
+
+// Maps the panel zone numbers a site uses, as one or more contiguous
+// ranges, onto dense indices so per-zone state only needs to be kept for
+// configured zones. Zone sets are bitsets of zoneWords() words by index.
+class ZoneMap {
+ public:
+    static const uint8_t maxRanges = 8;
+    static const uint16_t maxZone = 256;    // \Z takes a one byte zone offset
+    static const uint16_t configVersion = 1;
+
+    struct ZONE_RANGE {
+        uint16_t first;     // Panel zone number, Zone 1 = 1
+        uint16_t count;
+    };
+
+    struct ZONE_CONFIG {
+        uint16_t version;
+        uint8_t rangeCount;
+        ZONE_RANGE ranges[maxRanges];   // Ascending, not overlapping
+    };
+
+    struct ZONE_READ {
+        uint16_t index;     // First zone index read
+        uint16_t zone;      // and its panel zone number
+        uint8_t count;
+    };
+
+ public:
+    ZoneMap();
+    void begin(const ZONE_CONFIG *config);
+    uint16_t count() { return zoneTotal; }
+    uint16_t zoneWords() { return (zoneTotal + 31) / 32; }
+    int16_t indexOf(uint16_t zone);
+    uint16_t zoneNumber(uint16_t index);
+    bool nextRead(const uint32_t *zones, uint16_t from, uint8_t maxCount, ZONE_READ *read);
+    void fill(uint32_t *zones);
+    bool any(const uint32_t *zones);
+
+    static void getDefaultConfig(ZONE_CONFIG *config, uint16_t first, uint16_t count);
+    static bool parseConfig(const char *text, ZONE_CONFIG *config);
+    static bool isValid(const ZONE_CONFIG *config);
+
+ private:
+    uint16_t findNext(const uint32_t *zones, uint16_t from, uint16_t end);
+    uint16_t findLast(const uint32_t *zones, uint16_t from, uint16_t end);
+
+    ZONE_RANGE ranges[maxRanges];
+    uint16_t rangeIndex[maxRanges];     // Index of each range's first zone
+    uint8_t rangeCount = 0;
+    uint16_t zoneTotal = 0;
+};
+
+#endif  // __ZONEMAP_H_
@@ -0,0 +1,151 @@
+#include "zonestore.h"
+
+// Maps the two status bytes the panel returns for each zone onto planes.
+// The first byte's flags map straight across, bit 7 is always zero. The
+// second byte is only recorded as a whole.
+struct ZONE_STATUS_TABLE {
+    uint8_t first[256];
+    uint8_t second[256];
+
+    constexpr ZONE_STATUS_TABLE() : first(), second() {
+        for (int i = 0; i < 256; i++) {
+            first[i] = i & 0x7F;
+            second[i] = i ? 1 << ZoneStore::PLANE_EXTENDED : 0;
+        }
+    }
+};
+
+static constexpr ZONE_STATUS_TABLE statusTable;
+
+ZoneStore::ZoneStore() {}
+
+void ZoneStore::begin(uint16_t count) {
+    delete[] planes;
+    words = (count + 31) / 32;
+    planes = new uint32_t[PLANE_COUNT * words]();
+    blockingCount = 0;
+}
+
+uint8_t ZoneStore::get(uint16_t index) {
+    uint32_t *word = &planes[index / 32];
+    uint8_t shift = index % 32;
+    uint8_t flags = 0;
+
+    for (uint8_t p = 0; p < PLANE_COUNT; p++, word += words)
+        flags |= ((*word >> shift) & 1) << p;
+    return flags;
+}
+
+void ZoneStore::setPlane(uint16_t index, ZONE_PLANE plane, bool set) {
+    uint32_t *word = &planes[plane * words + index / 32];
+    uint8_t before = __builtin_popcount(blockingWord(index / 32));
+
+    if (set)
+        *word |= 1UL << (index % 32);
+    else
+        *word &= ~(1UL << (index % 32));
+
+    blockingCount += __builtin_popcount(blockingWord(index / 32)) - before;
+}
+
+// Stores the states of count zones from index, two bytes each, and marks
+// the zones that changed in changed, one word per word spanned starting at
+// word index / 32. Returns the number of words spanned.
+uint8_t ZoneStore::applyBlock(uint16_t index, const char *message, uint8_t count, uint32_t *changed) {
+    uint16_t firstWord = index / 32;
+    uint8_t span = (index + count - 1) / 32 - firstWord + 1;
+    uint32_t block[PLANE_COUNT][maxBlockWords];
+
+    memset(block, 0, sizeof(block));
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t flags = statusTable.first[(uint8_t) message[i * 2]] |
+                        statusTable.second[(uint8_t) message[i * 2 + 1]];
+        uint16_t bit = index % 32 + i;
+
+        while (flags) {
+            uint8_t p = __builtin_ctz(flags);
+            block[p][bit / 32] |= 1UL << (bit % 32);
+            flags &= flags - 1;
+        }
+    }
+
+    for (uint8_t w = 0; w < span; w++) {
+        uint32_t mask = blockMask(firstWord + w, index, count);
+        uint8_t before = __builtin_popcount(blockingWord(firstWord + w));
+        changed[w] = 0;
+
+        for (uint8_t p = 0; p < PLANE_COUNT; p++) {
+            uint32_t *word = &planes[p * words + firstWord + w];
+            uint32_t updated = (*word & ~mask) | block[p][w];
+            changed[w] |= *word ^ updated;
+            *word = updated;
+        }
+
+        blockingCount += __builtin_popcount(blockingWord(firstWord + w)) - before;
+    }
+    return span;
+}
+
+uint16_t ZoneStore::countSet(ZONE_PLANE plane) {
+    const uint32_t *word = getPlane(plane);
+    uint16_t total = 0;
+
+    for (uint16_t w = 0; w < words; w++)
+        total += __builtin_popcount(word[w]);
+    return total;
+}
+
+bool ZoneStore::any(ZONE_PLANE plane) {
+    const uint32_t *word = getPlane(plane);
+
+    for (uint16_t w = 0; w < words; w++) {
+        if (word[w])
+            return true;
+    }
+    return false;
+}
+
+// Fills indices with up to maxIndices blocking zones, in zone order
+uint16_t ZoneStore::findBlocking(uint16_t *indices, uint16_t maxIndices) {
+    uint16_t found = 0;
+
+    for (uint16_t w = 0; w < words && found < maxIndices; w++) {
+        uint32_t blocking = blockingWord(w);
+
+        while (blocking && found < maxIndices) {
+            indices[found++] = w * 32 + __builtin_ctz(blocking);
+            blocking &= blocking - 1;
+        }
+    }
+    return found;
+}
+
+uint32_t ZoneStore::blockingWord(uint16_t w) {
+    return (planes[PLANE_ACTIVE * words + w] | planes[PLANE_TAMPER * words + w]) &
+            ~(planes[PLANE_MANUAL_BYPASS * words + w] | planes[PLANE_AUTO_BYPASS * words + w]);
+}
+
+// Index of the first zone with the flag set, or -1 if none have it
+int32_t ZoneStore::findFirst(ZONE_PLANE plane) {
+    const uint32_t *word = getPlane(plane);
+
+    for (uint16_t w = 0; w < words; w++) {
+        if (word[w])
+            return w * 32 + __builtin_ctz(word[w]);
+    }
+    return -1;
+}
+
+// Bits of word that fall within count zones from index
+uint32_t ZoneStore::blockMask(uint16_t word, uint16_t index, uint8_t count) {
+    int32_t first = index - word * 32;
+    int32_t last = first + count;   // Exclusive
+
+    first = max(first, (int32_t) 0);
+    last = min(last, (int32_t) 32);
+    if (last <= first)
+        return 0;
+
+    uint32_t upper = last == 32 ? 0xFFFFFFFF : (1UL << last) - 1;
+    return upper & ~((1UL << first) - 1);
+}
@@ -0,0 +1,53 @@
+// Copyright 2020 Kevin Cooper
+
+#ifndef __ZONESTORE_H_
+#define __ZONESTORE_H_
+
+#include "Particle.h"
+
+// Zone state held as one packed bitset per flag, by ZoneMap index. Plane
+// n holds bit n of the zone flags, so a zone's flags read back unchanged,
+// while a whole block of zones is compared a word at a time and counts
+// across all zones are a popcount per word.
+class ZoneStore {
+ public:
+    typedef enum {
+        PLANE_ACTIVE = 0,
+        PLANE_TAMPER = 1,
+        PLANE_FAULT = 2,
+        PLANE_FAILED_TEST = 3,
+        PLANE_ALARMED = 4,
+        PLANE_MANUAL_BYPASS = 5,
+        PLANE_AUTO_BYPASS = 6,
+        PLANE_EXTENDED = 7,     // Any bit of the second status byte
+        PLANE_COUNT
+    } ZONE_PLANE;
+
+    static const uint8_t maxBlockWords = 3;  // Words a 48 zone read can span
+
+ public:
+    ZoneStore();
+    void begin(uint16_t count);
+    uint8_t get(uint16_t index);
+    void setPlane(uint16_t index, ZONE_PLANE plane, bool set);
+    uint8_t applyBlock(uint16_t index, const char *message, uint8_t count, uint32_t *changed);
+    uint16_t countSet(ZONE_PLANE plane);
+    bool any(ZONE_PLANE plane);
+    int32_t findFirst(ZONE_PLANE plane);
+    uint16_t getBlockingCount() { return blockingCount; }
+    uint16_t findBlocking(uint16_t *indices, uint16_t maxIndices);
+    const uint32_t* getPlane(ZONE_PLANE plane) { return &planes[plane * words]; }
+    static uint32_t blockMask(uint16_t word, uint16_t index, uint8_t count);
+
+ private:
+    uint32_t blockingWord(uint16_t w);
+
+    uint32_t *planes = NULL;    // PLANE_COUNT planes of words each
+    uint16_t words = 0;
+
+    // Zones that stop the system arming, active or tampered and not
+    // bypassed, counted as each word of the planes changes
+    uint16_t blockingCount = 0;
+};
+
+#endif  // __ZONESTORE_H_